@@ -0,0 +1,70 @@
+
+#ifndef HALIDE_EXPERIMENTS_BATCHPROCESSOR_H
+#define HALIDE_EXPERIMENTS_BATCHPROCESSOR_H
+
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+#include "Halide.h"
+#include "imaging.h"
+#include "statistics.h"
+#include "WorkStealingPool.h"
+#include "pipelines/HalidePipeline.h"
+
+using namespace Halide;
+
+struct BatchOptions {
+    int decodeThreads = 2;
+    // Each compute thread runs the shared compiled pipeline on its own images.
+    int computeThreads = 1;
+    int encodeThreads = 2;
+    // Capacity of the queues between the stages
+    int queueDepth = 4;
+    // Outputs are saved as <outputDirectory>/<input file stem><outputExtension>,
+    // with -2, -3, ... appended to the stem of the inputs whose stems repeat.
+    std::string outputDirectory = "outputs";
+    std::string outputExtension = ".png";
+    PngOptions pngOptions;
+    // Without saving, the encode stage only records the latencies.
+    bool saveOutputs = true;
+    /**
+     * If set, images are decoded and encoded by tasks of this pool (the one
+     * running the pipeline's parallel loops) instead of by dedicated threads,
+     * so that I/O and computation do not oversubscribe the cores.
+     */
+    WorkStealingPool *ioPool = nullptr;
+};
+
+/**
+ * Processes many images with one compiled pipeline. Decoding, computing
+ * and encoding run concurrently, connected by bounded queues: a pool of
+ * decode threads feeds the compute stage (which runs the Halide pipeline
+ * on the calling thread and on computeThreads - 1 more threads), which
+ * feeds a pool of encode threads. The throughput is thus limited by the
+ * slowest stage only. For small images, computing several images at once
+ * scales better than parallelizing the pipeline within each image.
+ */
+class BatchProcessor {
+private:
+    std::shared_ptr<HalidePipeline> pipeline;
+    Target target;
+    BatchOptions options;
+    std::function<Buffer<>(const std::string &)> loadImage;
+
+    // The output path of each image, unique within the batch
+    std::vector<std::string> outputPathsFor(const std::vector<std::string> &imagePaths) const;
+
+public:
+    BatchProcessor(std::shared_ptr<HalidePipeline> pipeline, const Target &target, BatchOptions options,
+                   std::function<Buffer<>(const std::string &)> loadImage);
+
+    /**
+     * Returns the throughput and latencies of the images processed
+     * successfully. Failures of individual images are reported and do
+     * not stop the batch.
+     */
+    BatchReport run(const std::vector<std::string> &imagePaths);
+};
+
+#endif //HALIDE_EXPERIMENTS_BATCHPROCESSOR_H
@@ -0,0 +1,72 @@
+
+#ifndef HALIDE_EXPERIMENTS_BOUNDEDQUEUE_H
+#define HALIDE_EXPERIMENTS_BOUNDEDQUEUE_H
+
+#include <condition_variable>
+#include <cstddef>
+#include <mutex>
+#include <optional>
+#include <queue>
+
+/**
+ * A blocking FIFO queue with a fixed capacity, connecting the stages
+ * of a producer-consumer pipeline. Producers block while the queue is
+ * full, which bounds the number of items in flight between stages.
+ */
+template<typename T>
+class BoundedQueue {
+private:
+    std::queue<T> items;
+    size_t capacity;
+    bool isClosed = false;
+
+    std::mutex mutex;
+    std::condition_variable notFull;
+    std::condition_variable notEmpty;
+
+public:
+    explicit BoundedQueue(size_t capacity) : capacity(capacity) {}
+
+    /**
+     * Blocks until there is space in the queue.
+     * Returns false (dropping the item) if the queue has been closed.
+     */
+    bool push(T item) {
+        std::unique_lock<std::mutex> lock(mutex);
+        notFull.wait(lock, [this] { return items.size() < capacity || isClosed; });
+        if (isClosed) {
+            return false;
+        }
+        items.push(std::move(item));
+        notEmpty.notify_one();
+        return true;
+    }
+
+    /**
+     * Blocks until an item is available. Returns an empty optional
+     * once the queue is closed and drained.
+     */
+    std::optional<T> pop() {
+        std::unique_lock<std::mutex> lock(mutex);
+        notEmpty.wait(lock, [this] { return !items.empty() || isClosed; });
+        if (items.empty()) {
+            return std::nullopt;
+        }
+        T item = std::move(items.front());
+        items.pop();
+        notFull.notify_one();
+        return item;
+    }
+
+    /**
+     * No more items will be pushed; consumers drain the remaining ones.
+     */
+    void close() {
+        std::lock_guard<std::mutex> lock(mutex);
+        isClosed = true;
+        notFull.notify_all();
+        notEmpty.notify_all();
+    }
+};
+
+#endif //HALIDE_EXPERIMENTS_BOUNDEDQUEUE_H
@@ -0,0 +1,76 @@
+
+#ifndef HALIDE_EXPERIMENTS_BUFFERARENA_H
+#define HALIDE_EXPERIMENTS_BUFFERARENA_H
+
+#include <atomic>
+#include <cstddef>
+#include <map>
+#include <mutex>
+#include <vector>
+#include "Halide.h"
+#include "statistics.h"
+
+using namespace Halide;
+
+/**
+ * Recycles the heap allocations of Halide pipelines (the buffers of their
+ * compute_root and other non-inlined intermediates) instead of returning
+ * them to the system after each realization. Freed blocks are kept in free
+ * lists by size class, which are a quarter of a power of two apart, and
+ * handed out again to the next allocation of the same class, whether in the
+ * next rep or for the next image of a batch. This saves the mmap/munmap
+ * calls and, above all, the page faults of touching fresh memory.
+ *
+ * Blocks are allocated following the page policy (see pages.h), so large
+ * ones can be backed by huge pages and prefaulted once, when first allocated.
+ *
+ * The arena is process-wide: the installed handlers ignore their
+ * JITUserContext and use current(), the last arena constructed. All the
+ * pipelines installing it thus share its free lists, and a block freed by
+ * one pipeline, thread or NUMA node is handed to whichever allocates its
+ * size class next. Pipelines whose memory must stay apart, such as the
+ * bands of NumaExecutor placed by first touch, must not use it (main
+ * rejects --arena with --numa).
+ */
+class BufferArena {
+private:
+    size_t maxRetainedBytes;
+
+    mutable std::mutex mutex;
+    // Free blocks by size class
+    std::map<size_t, std::vector<void *>> freeBlocks;
+    size_t retainedBytes = 0;
+    ArenaStatistics counters;
+
+    static void *allocate(JITUserContext *context, size_t size);
+
+    static void release(JITUserContext *context, void *block);
+
+public:
+    /**
+     * Beyond maxRetainedBytes of free blocks, freed blocks are unmapped,
+     * so that images of changing sizes do not accumulate memory.
+     */
+    explicit BufferArena(size_t maxRetainedBytes = size_t(1) << 30);
+
+    ~BufferArena();
+
+    BufferArena(const BufferArena &) = delete;
+
+    BufferArena &operator=(const BufferArena &) = delete;
+
+    /**
+     * Routes the heap allocations of the pipeline owning the handlers to
+     * the current arena, whichever it is when they are made; without one,
+     * blocks are allocated and freed following the page policy. Must be
+     * called before the pipeline is compiled.
+     */
+    static void install(JITHandlers &handlers);
+
+    ArenaStatistics statistics() const;
+
+    // The arena the installed handlers use: the last one constructed.
+    static BufferArena *current();
+};
+
+#endif //HALIDE_EXPERIMENTS_BUFFERARENA_H
@@ -0,0 +1,67 @@
+
+#ifndef HALIDE_EXPERIMENTS_DEBUGDUMP_H
+#define HALIDE_EXPERIMENTS_DEBUGDUMP_H
+
+#include <string>
+#include <vector>
+#include "Halide.h"
+#include "imaging.h"
+#include "pipelines/HalidePipeline.h"
+
+using namespace Halide;
+
+/**
+ * Decides which artifacts of a run are written to disk, and writes them.
+ * Nothing is dumped unless requested, so none of the cost is paid
+ * in production runs.
+ */
+class DebugDump {
+public:
+    enum Artifact : unsigned {
+        None = 0,
+        Input = 1u << 0,
+        Intermediates = 1u << 1,
+        Output = 1u << 2,
+        All = Input | Intermediates | Output,
+    };
+
+private:
+    unsigned artifacts;
+    std::string directory;
+    // Stages to dump; all of them if empty.
+    std::vector<std::string> stageNames;
+
+    bool isStageSelected(const std::string &stageName) const;
+
+public:
+    DebugDump(unsigned artifacts, const std::string &directory, const std::vector<std::string> &stageNames = {});
+
+    /**
+     * Parses a comma-separated list of none, input, intermediates, output and all.
+     * Throws std::invalid_argument on unknown artifacts.
+     */
+    static unsigned parseArtifacts(const std::string &policy);
+
+    bool isEnabled(Artifact artifact) const;
+
+    void dumpInput(const Buffer<> &image) const;
+
+    /**
+     * Checks that the pipeline has all the stages asked for, before any time
+     * is spent running it.
+     * @throws std::invalid_argument naming the stages that can be dumped otherwise.
+     */
+    void checkStages(HalidePipeline &pipeline) const;
+
+    /**
+     * Realizes the selected stages of the pipeline over the input's extent and
+     * saves them losslessly as raw images (<directory>/<stage>.hlraw).
+     * The pipeline must be a fresh, unscheduled instance, a reference recompute:
+     * stages are realized on their own, which the schedule of the measured
+     * pipeline may not allow. Each dumped stage is computed at the root, in
+     * parallel rows, and reused by the stages dumped after it.
+     */
+    void dumpStages(HalidePipeline &pipeline, const Buffer<> &image, const Target &target) const;
+};
+
+#endif //HALIDE_EXPERIMENTS_DEBUGDUMP_H
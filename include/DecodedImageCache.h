@@ -0,0 +1,43 @@
+
+#ifndef HALIDE_EXPERIMENTS_DECODEDIMAGECACHE_H
+#define HALIDE_EXPERIMENTS_DECODEDIMAGECACHE_H
+
+#include <cstdint>
+#include <filesystem>
+#include <string>
+#include "imaging.h"
+
+/**
+ * On-disk cache of decoded images, stored as raw images named after
+ * a hash and the size of the encoded file's contents. Hits are mapped
+ * as raw images instead of decoded, without copying their pixels; entries
+ * that fail to load (e.g., evicted by another process meanwhile) are
+ * decoded again. The total
+ * size of the cache is bounded; the least recently used entries are
+ * evicted first.
+ */
+class DecodedImageCache {
+private:
+    std::filesystem::path directory;
+    uint64_t maxSizeBytes;
+
+    std::filesystem::path entryPath(uint64_t contentHash, uint64_t contentSize, bool alignRows) const;
+
+    void store(const Buffer<> &image, const std::filesystem::path &path) const;
+
+    void evict() const;
+
+public:
+    DecodedImageCache(const std::string &directory, uint64_t maxSizeBytes);
+
+    /**
+     * Loads the image from the cache, or decodes it and adds it to the cache.
+     *
+     * Throws std::runtime_error if the file cannot be read or decoded.
+     */
+    Buffer<> load(const std::string &filePath, bool alignRows = false);
+
+    static uint64_t hashContent(const uint8_t *data, size_t size);
+};
+
+#endif //HALIDE_EXPERIMENTS_DECODEDIMAGECACHE_H
@@ -0,0 +1,64 @@
+
+#ifndef HALIDE_EXPERIMENTS_NUMAEXECUTOR_H
+#define HALIDE_EXPERIMENTS_NUMAEXECUTOR_H
+
+#include <functional>
+#include <memory>
+#include <ostream>
+#include <vector>
+#include "Halide.h"
+#include "numa.h"
+#include "WorkStealingPool.h"
+
+using namespace Halide;
+
+/**
+ * Runs a pipeline on a NUMA machine as one band of rows per node, so that
+ * no node reads the memory of another. Each node has its own work-stealing
+ * pool, pinned to its CPUs, which copies the node's band of the input
+ * (with the rows around it the band depends on) and allocates its band of
+ * the output. Pages are placed on the node of the thread touching them
+ * first, so these buffers, as well as the intermediates the pipeline
+ * allocates while running on the node's workers, stay local.
+ */
+class NumaExecutor {
+private:
+    struct Band {
+        NumaNode node;
+        std::unique_ptr<WorkStealingPool> pool;
+        // Rows [top, top + height) of the output
+        int top = 0;
+        int height = 0;
+        Buffer<> input;
+        Buffer<> output;
+    };
+
+    std::vector<Band> bands;
+
+    // Runs function(band) on a worker of each band's node and waits for all of them.
+    void forEachBand(const std::function<void(Band &)> &function);
+
+public:
+    explicit NumaExecutor(const std::vector<NumaNode> &nodes);
+
+    /**
+     * Splits the image into bands of rows proportional to the nodes' CPU
+     * counts, each overlapping its neighbors by halo rows (see
+     * HalidePipeline::halo()), and copies them to their nodes.
+     */
+    void distribute(const Buffer<> &image, int halo, const Type &outputType);
+
+    /**
+     * Runs the callable (see HalidePipeline::compileToCallable()) on all
+     * the bands at once, each on its node's pool.
+     * @throws std::runtime_error if it fails on any band.
+     */
+    void run(Callable &callable);
+
+    // Copies the bands of the output into the output image.
+    void gather(Buffer<> &output) const;
+
+    void printBands(std::ostream &stream) const;
+};
+
+#endif //HALIDE_EXPERIMENTS_NUMAEXECUTOR_H
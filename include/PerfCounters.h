@@ -0,0 +1,74 @@
+
+#ifndef HALIDE_EXPERIMENTS_PERFCOUNTERS_H
+#define HALIDE_EXPERIMENTS_PERFCOUNTERS_H
+
+#include <cstdint>
+#include <map>
+#include <string>
+#include <vector>
+
+enum class PerfEvent {
+    Cycles,
+    Instructions,
+    // Loads missing the L1 data cache
+    L1DataMisses,
+    // References missing the last-level cache
+    LastLevelCacheMisses,
+    DataTlbMisses,
+};
+
+using PerfCounts = std::map<PerfEvent, uint64_t>;
+
+// Adds the counts to the total, event by event.
+inline void accumulate(PerfCounts &total, const PerfCounts &counts) {
+    for (const auto &entry: counts) {
+        total[entry.first] += entry.second;
+    }
+}
+
+/**
+ * Hardware event counts of the process, read through perf_event_open(2).
+ * Like `perf stat -p`, the counters follow the threads of the process
+ * present when they are opened, so they are best opened once the worker
+ * threads exist (e.g., after a warm-up run). Only user-space events are
+ * counted, which most systems allow (see /proc/sys/kernel/perf_event_paranoid).
+ *
+ * Events that cannot be counted (no permission, no PMU in a VM, or not
+ * Linux) are left out rather than failing.
+ */
+class PerfCounters {
+private:
+    struct Counter {
+        PerfEvent event;
+        // One per thread
+        std::vector<int> descriptors;
+    };
+
+    std::vector<Counter> counters;
+
+public:
+    explicit PerfCounters(const std::vector<PerfEvent> &events);
+
+    ~PerfCounters();
+
+    PerfCounters(const PerfCounters &) = delete;
+
+    PerfCounters &operator=(const PerfCounters &) = delete;
+
+    bool isCounting(PerfEvent event) const;
+
+    // Resets and enables the counters.
+    void start();
+
+    /**
+     * Disables the counters and returns their counts since start(), scaled
+     * up when the kernel had to multiplex them. Only counted events appear.
+     */
+    PerfCounts stop();
+
+    static std::string name(PerfEvent event);
+
+    static std::vector<PerfEvent> allEvents();
+};
+
+#endif //HALIDE_EXPERIMENTS_PERFCOUNTERS_H
@@ -0,0 +1,101 @@
+
+#ifndef HALIDE_EXPERIMENTS_TRACER_H
+#define HALIDE_EXPERIMENTS_TRACER_H
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+#include "Halide.h"
+#include "pipelines/HalidePipeline.h"
+
+using namespace Halide;
+
+/**
+ * Records timed spans of the program (decoding, compiling, each rep,
+ * copies, encoding) and of the Halide pipelines (the realization, produce
+ * and consume of each traced Func, on the thread running it), and writes
+ * them as a Chrome trace (JSON), which Perfetto (ui.perfetto.dev) and
+ * chrome://tracing display on a timeline per thread. The produce spans of
+ * the tiles computed in parallel show how evenly the workers were loaded,
+ * and the spans of the batch mode how its stages overlap.
+ */
+class Tracer {
+private:
+    using Clock = std::chrono::steady_clock;
+
+    struct Event {
+        std::string name;
+        std::string category;
+        int thread;
+        // Microseconds since the tracer was created
+        double start;
+        double duration;
+        std::string detail;
+    };
+
+    Clock::time_point origin;
+    std::atomic<int32_t> nextSpanId{1};
+
+    mutable std::mutex mutex;
+    std::vector<Event> events;
+    // Halide's begin events by the id returned for them, until their end events
+    std::map<int32_t, Event> openSpans;
+
+    static int32_t trace(JITUserContext *context, const halide_trace_event_t *event);
+
+public:
+    /**
+     * A span of the current tracer, from its construction to its
+     * destruction, on the constructing thread. Does nothing without a tracer.
+     */
+    class Span {
+    private:
+        Tracer *tracer;
+        Event event;
+
+    public:
+        Span(const std::string &category, const std::string &name, const std::string &detail = "");
+
+        ~Span();
+
+        Span(const Span &) = delete;
+
+        Span &operator=(const Span &) = delete;
+    };
+
+    Tracer();
+
+    ~Tracer();
+
+    Tracer(const Tracer &) = delete;
+
+    Tracer &operator=(const Tracer &) = delete;
+
+    // Microseconds since the tracer was created
+    double now() const;
+
+    /**
+     * Traces the realizations of all the Funcs of the pipeline and routes
+     * their events to the current tracer. Must be called before the
+     * pipeline is compiled. Tracing adds a call per produce and consume of
+     * each Func, so the traced timings are somewhat longer.
+     */
+    static void install(HalidePipeline &pipeline);
+
+    /**
+     * Writes the spans recorded so far.
+     * @throws std::runtime_error if the file cannot be written.
+     */
+    void write(const std::string &path) const;
+
+    size_t eventCount() const;
+
+    // The tracer the spans and the installed handlers use: the last one constructed.
+    static Tracer *current();
+};
+
+#endif //HALIDE_EXPERIMENTS_TRACER_H
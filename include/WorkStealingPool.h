@@ -0,0 +1,167 @@
+
+#ifndef HALIDE_EXPERIMENTS_WORKSTEALINGPOOL_H
+#define HALIDE_EXPERIMENTS_WORKSTEALINGPOOL_H
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "Halide.h"
+#include "statistics.h"
+
+using namespace Halide;
+
+/**
+ * A thread pool with one worker per core, each pinned to its core and
+ * owning a deque of tasks. Workers run their own tasks newest first and,
+ * when out of work, steal the oldest tasks of the others. Threads waiting
+ * for a parallel loop run its tasks too, so that nested loops cannot
+ * deadlock the pool.
+ *
+ * A pipeline called with a Context of the pool runs its parallel loops on
+ * the pool in place of the Halide runtime's thread pool. Other work, such
+ * as the I/O of the batch mode, can be submitted to the same workers, so
+ * that it does not compete with them for the cores.
+ */
+class WorkStealingPool {
+private:
+    using Task = std::function<void()>;
+
+    struct Worker {
+        std::mutex mutex;
+        std::deque<Task> tasks;
+        std::thread thread;
+    };
+
+    std::vector<std::unique_ptr<Worker>> workers;
+    std::atomic<int> pendingTasks{0};
+    std::atomic<unsigned> nextWorker{0};
+    bool isStopping = false;
+
+    std::mutex sleepMutex;
+    std::condition_variable wakeUp;
+    // Wakes the threads waiting in helpUntil() once a task is submitted or finishes.
+    std::condition_variable helperWakeUp;
+    std::atomic<int> sleepingHelpers{0};
+
+    std::atomic<bool> isMonitoring{false};
+    std::mutex monitorMutex;
+    std::vector<LoopLoad> monitoredLoops;
+
+    int runLoop(int min, int size, const std::function<int(int)> &body);
+
+    // Takes a task from the given worker's deque or steals one; -1 only steals.
+    bool runTask(int workerIndex);
+
+    void work(int workerIndex);
+
+    void wakeHelpers();
+
+    // The index of the calling thread among this pool's workers, or -1.
+    int currentWorker() const;
+
+    static int doParFor(JITUserContext *context, int (*task)(JITUserContext *, int, uint8_t *),
+                        int min, int size, uint8_t *closure);
+
+    static int doTask(JITUserContext *context, int (*task)(JITUserContext *, int, uint8_t *),
+                      int index, uint8_t *closure);
+
+public:
+    /**
+     * The user context to call a pipeline with, so that its parallel loops,
+     * nested ones included, run on the given pool (on the Halide runtime's
+     * thread pool for nullptr). Halide fills the context in with the other
+     * handlers of the pipeline it calls, so each call takes a context of
+     * its own, e.g., on the stack:
+     *
+     *     WorkStealingPool::Context context(pool);
+     *     checkCall(callable(context.get(), input, output));
+     */
+    class Context : public JITUserContext {
+    private:
+        WorkStealingPool *pool;
+
+        friend class WorkStealingPool;
+
+    public:
+        explicit Context(WorkStealingPool *pool);
+
+        // Halide recognizes the context by its exact type, JITUserContext *.
+        JITUserContext *get() {
+            return this;
+        }
+    };
+
+    /**
+     * Starts the given number of workers (one per CPU the process may run
+     * on for 0, see allowedCpus()). Worker i is pinned to the i-th of those
+     * CPUs (modulo their number) if pinWorkers is set.
+     */
+    explicit WorkStealingPool(int threadCount = 0, bool pinWorkers = true);
+
+    /**
+     * Starts one worker per given core, pinned to it (not pinned for -1).
+     * Workers that cannot be pinned run unpinned, which is reported on std::cerr.
+     * Unlike the pool above, it does not become the current one: the loops
+     * it runs are those started from its own workers, e.g., by a pipeline
+     * called from a submitted task.
+     */
+    explicit WorkStealingPool(const std::vector<int> &cores);
+
+    ~WorkStealingPool();
+
+    WorkStealingPool(const WorkStealingPool &) = delete;
+
+    WorkStealingPool &operator=(const WorkStealingPool &) = delete;
+
+    int threadCount() const {
+        return (int) workers.size();
+    }
+
+    // Thread-safe, also from the pool's own workers.
+    void submit(Task task);
+
+    /**
+     * Runs body(i) for each i in [min, min + size) on the workers and the
+     * calling thread, and waits for all of them. Returns the first nonzero
+     * result of body, after which the remaining iterations are skipped.
+     */
+    int parallelFor(int min, int size, const std::function<int(int)> &body);
+
+    /**
+     * Times each task of the parallel loops from now on, and how long each
+     * thread was busy with them, until stopMonitoring(). Loops nested in a
+     * task count towards both loops.
+     */
+    void startMonitoring();
+
+    // The loops run since startMonitoring(), in the order they finished
+    std::vector<LoopLoad> stopMonitoring();
+
+    /**
+     * Runs tasks of the pool on the calling thread until isDone() holds,
+     * which is checked again whenever a task finishes. Without tasks to
+     * run, the thread spins for a moment, then sleeps.
+     */
+    void helpUntil(const std::function<bool()> &isDone);
+
+    /**
+     * Runs the function on one of the workers and waits for it, so that the
+     * parallel loops it starts run on exactly this pool's threads.
+     * Rethrows what the function throws.
+     */
+    void runOnWorker(const std::function<void()> &function);
+
+    /**
+     * The pool to run the program's pipelines and I/O on: on the workers of
+     * a pool, that pool, and on other threads, the last one constructed with
+     * a thread count.
+     */
+    static WorkStealingPool *current();
+};
+
+#endif //HALIDE_EXPERIMENTS_WORKSTEALINGPOOL_H
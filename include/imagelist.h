@@ -0,0 +1,25 @@
+
+#ifndef HALIDE_EXPERIMENTS_IMAGELIST_H
+#define HALIDE_EXPERIMENTS_IMAGELIST_H
+
+#include <string>
+#include <vector>
+
+/**
+ * Whether the argument names a set of images rather than a single file:
+ * a directory, a glob pattern (e.g., "images/*.jpg") or a file list
+ * given as @<path> (one image path per line, # starts a comment).
+ */
+bool isImageCollection(const std::string &pathOrPattern);
+
+/**
+ * Expands directories (their image files, non-recursively), glob
+ * patterns and @file lists into image paths. Other arguments are kept
+ * as they are. Directory and glob matches are sorted.
+ *
+ * Throws std::runtime_error if a directory or file list cannot be read,
+ * or if they expand to no image at all.
+ */
+std::vector<std::string> expandImagePaths(const std::vector<std::string> &pathsOrPatterns);
+
+#endif //HALIDE_EXPERIMENTS_IMAGELIST_H
@@ -1,13 +1,78 @@
 
-
 #ifndef HALIDE_EXPERIMENTS_IMAGING_H
 #define HALIDE_EXPERIMENTS_IMAGING_H
 
+#include <string>
+#include "Halide.h"
+
+using namespace Halide;
+
+// Rows of repacked images start on this boundary (in bytes), and their
+// stride is padded to a multiple of it so that every row is aligned.
+constexpr int imageRowAlignment = 64;
+
 Buffer<uint8_t> createNoisyImage(int size, float gaussianNoiseSigma);
 
-Buffer<uint8_t> loadImageFromFile(const std::string &filePath);
+/**
+ * Decodes an image file into a buffer that owns its pixels, allocated after
+ * the page policy (see pages.h). The pixel type is that of the file: uint8,
+ * uint16 (16-bit PNGs) or float (HDR images), or any type for raw images.
+ * The pixels are interleaved, in rows aligned to imageRowAlignment bytes with
+ * alignRows. Raw images (.hlraw) are mapped instead, keeping the layout
+ * they were saved with (see loadRawImage()).
+ *
+ * Throws std::runtime_error if the file cannot be decoded.
+ */
+Buffer<> loadImageFromFile(const std::string &filePath, bool alignRows = false);
+
+/**
+ * Decodes an image held in memory (e.g., the contents of a JPEG file).
+ *
+ * Throws std::runtime_error if the data cannot be decoded.
+ */
+Buffer<> loadImageFromMemory(const uint8_t *encoded, size_t size, bool alignRows = false);
+
+/**
+ * Returns the pixel type loadImageFromFile() would produce, without decoding the image.
+ */
+Type probePixelType(const std::string &filePath);
+
+/**
+ * Output formats, selected by the file extension.
+ */
+enum class ImageFormat {
+    // Default for unknown extensions
+    Png,
+    // .pgm (single channel) and .ppm (three channels), binary and uncompressed
+    Pgm,
+    Ppm,
+    // .raw: interleaved rows without a header
+    Raw,
+    // .hlraw: raw image container (see rawimage.h)
+    RawContainer,
+};
+
+ImageFormat imageFormatFromPath(const std::string &filePath);
+
+struct PngOptions {
+    // zlib level, 0 to 9; higher compresses better but slower.
+    // Without zlib, stb_image_write treats anything below 5 as 5.
+    int compressionLevel = 8;
+    // Filter of all rows: 0 (none), 1 (sub), 2 (up), 3 (average), 4 (Paeth),
+    // or -1 to pick the best one for each row.
+    int filter = -1;
+    // Encoder strips (see pngwriter.h); 0 uses all cores. Without zlib, PNGs
+    // are written by stb_image_write, on one thread and with the level and
+    // filter of the first PNG written (it keeps them in globals).
+    int threads = 0;
+};
 
-void saveImageToFile(Buffer<uint8_t> image, const std::string &targetFilePath);
+/**
+ * Saves the image in the format given by the extension of the target path.
+ * 8- and 16-bit images are saved as they are. Float images are saved as they
+ * are in raw formats, and quantized from [0, 1] to 16 bits otherwise.
+ */
+void saveImageToFile(Buffer<> image, const std::string &targetFilePath, const PngOptions &pngOptions = {});
 
 
 #endif //HALIDE_EXPERIMENTS_IMAGING_H
@@ -0,0 +1,33 @@
+
+#ifndef HALIDE_EXPERIMENTS_MACHINE_H
+#define HALIDE_EXPERIMENTS_MACHINE_H
+
+#include <cstddef>
+#include "Halide.h"
+#include "statistics.h"
+#include "WorkStealingPool.h"
+
+using namespace Halide;
+
+/**
+ * Measures the memory bandwidth the workers of the pool reach together
+ * with a STREAM triad (a[i] = b[i] + s * c[i]) over three arrays of the
+ * given size, well beyond the last-level cache. Returns the best of a few
+ * runs, in bytes per second, counting the bytes read and written.
+ */
+double measureMemoryBandwidth(WorkStealingPool &pool, size_t arrayBytes = size_t(64) << 20);
+
+/**
+ * Measures the floating-point operations per second the workers of the
+ * pool reach together, with a Halide kernel of independent chains of
+ * multiply-adds vectorized for the target (each counted as two operations).
+ */
+double measurePeakOperationRate(WorkStealingPool &pool, const Target &target);
+
+/**
+ * Measures both peaks on the current pool (see WorkStealingPool::current()),
+ * or on a pool with a worker per core.
+ */
+MachinePeaks measureMachinePeaks(const Target &target);
+
+#endif //HALIDE_EXPERIMENTS_MACHINE_H
@@ -0,0 +1,33 @@
+
+#ifndef HALIDE_EXPERIMENTS_NUMA_H
+#define HALIDE_EXPERIMENTS_NUMA_H
+
+#include <string>
+#include <vector>
+
+struct NumaNode {
+    int id;
+    std::vector<int> cpus;
+};
+
+/**
+ * Parses a Linux CPU list, e.g., "0-15,32-47".
+ * Throws std::invalid_argument if it is malformed.
+ */
+std::vector<int> parseCpuList(const std::string &list);
+
+/**
+ * The CPUs the process may run on (its affinity, e.g., as restricted by
+ * taskset or a cpuset), in increasing order. Where that is unavailable,
+ * all the cores.
+ */
+std::vector<int> allowedCpus();
+
+/**
+ * The NUMA nodes having CPUs the process may run on, as listed in
+ * /sys/devices/system/node, with only those CPUs. Where that is
+ * unavailable, a single node 0 with all the allowed CPUs.
+ */
+std::vector<NumaNode> detectNumaNodes();
+
+#endif //HALIDE_EXPERIMENTS_NUMA_H
@@ -0,0 +1,88 @@
+
+#ifndef HALIDE_EXPERIMENTS_PAGES_H
+#define HALIDE_EXPERIMENTS_PAGES_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "Halide.h"
+
+using namespace Halide;
+
+enum class HugePages {
+    // Regular 4 KB pages
+    None,
+    // 2 MB-aligned memory advised with MADV_HUGEPAGE, which the kernel
+    // backs with transparent huge pages where it can.
+    Transparent,
+    // MAP_HUGETLB, from the pages reserved in /proc/sys/vm/nr_hugepages;
+    // transparent huge pages once none are left.
+    Reserved,
+};
+
+/**
+ * How the memory of large buffers (inputs, outputs and intermediates)
+ * is allocated. A 4K float image is about 33 MB, i.e., 8000 regular pages,
+ * each of which faults on its first touch and takes a TLB entry.
+ */
+struct PagePolicy {
+    HugePages hugePages = HugePages::None;
+    // Touches all the pages at allocation, so that the first run does not fault.
+    bool prefault = false;
+
+    bool isDefault() const {
+        return hugePages == HugePages::None && !prefault;
+    }
+};
+
+/**
+ * Parses "none", "thp" or "hugetlb".
+ * Throws std::invalid_argument for anything else.
+ */
+HugePages parseHugePages(const std::string &name);
+
+std::string describePagePolicy(const PagePolicy &policy);
+
+// Set before allocating, the policy applies to all allocations from then on.
+void setPagePolicy(const PagePolicy &policy);
+
+PagePolicy pagePolicy();
+
+/**
+ * Allocates at least size bytes, aligned to 128 bytes, following the
+ * policy. Blocks below 1 MB come from malloc. Returns null on failure.
+ * Also usable as the allocation function of a Halide buffer.
+ */
+void *allocatePages(size_t size);
+
+void freePages(void *block);
+
+// The size the block was allocated with
+size_t allocatedSize(const void *block);
+
+// A buffer whose memory follows the policy
+Buffer<> allocateBuffer(const Type &type, const std::vector<int> &sizes);
+
+// A buffer of the given shape, strides included, whose memory follows the policy
+Buffer<> allocateBuffer(const Type &type, int dimensions, const halide_dimension_t *shape);
+
+// A copy of the buffer (with the same layout) whose memory follows the policy
+Buffer<> copyBuffer(const Buffer<> &buffer);
+
+/**
+ * Routes the heap allocations of the pipeline owning the handlers (its
+ * intermediates) through the policy. Must be called before compiling it.
+ */
+void installPagePolicy(JITHandlers &handlers);
+
+/**
+ * Allocations that asked for reserved huge pages (HugePages::Reserved) but
+ * got transparent ones, as none were left, so far.
+ */
+uint64_t countHugetlbFallbacks();
+
+// Page faults of the process so far, minor and major
+uint64_t countPageFaults();
+
+#endif //HALIDE_EXPERIMENTS_PAGES_H
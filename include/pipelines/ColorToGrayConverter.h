@@ -6,23 +6,28 @@
 #include <cstdint>
 #include "Halide.h"
 #include "HalidePipeline.h"
+#include "PixelTraits.h"
 
 using namespace Halide;
 
+/**
+ * Instantiated for uint8_t, uint16_t and float pixels.
+ */
+template<typename T>
 class ColorToGrayConverter : public HalidePipeline {
 private:
-    Buffer<uint8_t> input;
-
     void implement();
 
 public:
     Var x, y, c;
 
-    explicit ColorToGrayConverter(const Buffer<uint8_t> &input);
+    ColorToGrayConverter();
 
     bool scheduleForGPU() override;
 
     void scheduleForCPU() override;
+
+    double operationsPerPixel() const override;
 };
 
 #endif //HALIDE_EXPERIMENTS_COLORTOGRAYCONVERTER_H
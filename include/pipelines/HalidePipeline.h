@@ -2,18 +2,124 @@
 #ifndef HALIDE_EXPERIMENTS_HALIDEPIPELINE_H
 #define HALIDE_EXPERIMENTS_HALIDEPIPELINE_H
 
+#include <map>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
 #include "Halide.h"
 
 using namespace Halide;
 
 class HalidePipeline {
 public:
+    // Bound to an image before each realization, so that the compiled
+    // pipeline can be reused for any number of images.
+    ImageParam input;
     Func result;
 
+    /**
+     * The pixels this pipeline reads: the input image, or the result of
+     * the upstream pipeline when pipelines are chained. A chain shares the
+     * input of its first pipeline and compiles into one Halide pipeline.
+     */
+    Func source;
+    std::shared_ptr<HalidePipeline> upstream;
+
+    /**
+     * The CPU schedule to apply, one of the variants the pipeline is
+     * registered with (see PipelineRegistry). Empty for the default one.
+     */
+    std::string scheduleVariant;
+
+    explicit HalidePipeline(const ImageParam &input) : input(input), source(input) {}
+
+    explicit HalidePipeline(std::shared_ptr<HalidePipeline> upstream)
+            : input(upstream->input), source(upstream->result), upstream(std::move(upstream)) {}
+
+    virtual ~HalidePipeline() = default;
+
+    /**
+     * Compiles the scheduled pipeline into a Callable taking the input and
+     * the output buffer. Unlike Func::realize(), calling it involves no
+     * argument packing or JIT cache lookup, and it does not depend on the
+     * input being set, so it can be called from several threads at once.
+     */
+    Callable compileToCallable(const Target &target) {
+        return result.compile_to_callable({input}, target);
+    }
+
+    /**
+     * Lowers the pipeline to Halide's IR, without generating machine code,
+     * so that lowering can be timed apart from the rest of the compilation.
+     */
+    Module lower(const Target &target) {
+        return result.compile_to_module({input}, result.name(), target);
+    }
+
     virtual bool scheduleForGPU() = 0;
 
     virtual void scheduleForCPU() = 0;
+
+    /**
+     * Intermediate stages defined over the same 2D domain as the result,
+     * which can be realized on their own (e.g., to be inspected).
+     */
+    virtual std::vector<Func> stages() {
+        return {};
+    }
+
+    /**
+     * The Funcs a schedule can refer to, by name. Funcs of the upstream
+     * pipeline are prefixed with "upstream.".
+     */
+    virtual std::map<std::string, Func> funcs() {
+        std::map<std::string, Func> funcs = {{"result", result}};
+        if (upstream) {
+            for (const auto &entry: upstream->funcs()) {
+                funcs.emplace("upstream." + entry.first, entry.second);
+            }
+        }
+        return funcs;
+    }
+
+    /**
+     * How far from a pixel of the result the pixels it depends on can lie,
+     * upstream pipelines included. Bands of an image processed apart (see
+     * NumaExecutor) must overlap by this many rows.
+     */
+    virtual int halo() const {
+        return upstream ? upstream->halo() : 0;
+    }
+
+    /**
+     * The arithmetic operations computing one pixel of the result,
+     * upstream pipelines included, after the pipeline's cost model.
+     */
+    virtual double operationsPerPixel() const {
+        return upstream ? upstream->operationsPerPixel() : 0;
+    }
+
+    /**
+     * The bytes a pixel of the result moves at the least: the input pixel
+     * read and the result written once. Intermediates are not counted, so
+     * the bandwidth derived from it is a lower bound of the actual one.
+     */
+    double bytesPerPixel() const {
+        int inputChannels = input.dimensions() > 2 ? 3 : 1;
+        return inputChannels * input.type().bytes() + result.output_type().bytes();
+    }
 };
 
 
+/**
+ * Checks the result of a Callable. The error itself has already been
+ * reported by Halide's error handler.
+ */
+inline void checkCall(int errorCode) {
+    if (errorCode != 0) {
+        throw std::runtime_error("The pipeline failed with error code " + std::to_string(errorCode));
+    }
+}
+
 #endif //HALIDE_EXPERIMENTS_HALIDEPIPELINE_H
@@ -5,22 +5,34 @@
 #include <cstdint>
 #include "Halide.h"
 #include "HalidePipeline.h"
+#include "PixelTraits.h"
 
 using namespace Halide;
 
+/**
+ * Instantiated for uint8_t, uint16_t and float pixels. Everything is
+ * computed in float, on samples normalized to [0, 1] by the maxValue
+ * of PixelTraits.
+ */
+template<typename T>
 class NonlocalMeansFilter : public HalidePipeline {
 private:
-    Buffer<uint8_t> input;
     int patchSize;
     int searchWindowSize;
 
-    float h = 0.1;
+    // The degree of filtering
+    float h;
     float weighingGaussianSigma = 1.5f;
 
     void implement();
 
     static Func createGaussian(int width, int height, float sigma);
 
+    // Schedules the upstream pipeline into the tiles of this one.
+    void scheduleFusedForCPU();
+
+    void scheduleFusedForGPU();
+
 public:
     // Coordinates of point 1
     Var x, y;
@@ -39,12 +51,26 @@ public:
     Func newPixelValues;
     Func newPixelValuesNormalized;
 
-    explicit NonlocalMeansFilter(const Buffer<uint8_t>& input, int patchSize, int searchWindowSize);
+    NonlocalMeansFilter(int patchSize, int searchWindowSize, float h = 0.1f);
+
+    /**
+     * Filters the (single-channel) result of the upstream pipeline,
+     * e.g., of a ColorToGrayConverter, as part of the same pipeline.
+     */
+    NonlocalMeansFilter(int patchSize, int searchWindowSize, float h, std::shared_ptr<HalidePipeline> upstream);
 
     bool scheduleForGPU() override;
 
     void scheduleForCPU() override;
 
+    std::vector<Func> stages() override;
+
+    std::map<std::string, Func> funcs() override;
+
+    int halo() const override;
+
+    double operationsPerPixel() const override;
+
 };
 
 #endif //HALIDE_EXPERIMENTS_NONLOCALMEANSFILTER_H
@@ -0,0 +1,89 @@
+
+#ifndef HALIDE_EXPERIMENTS_PIPELINEREGISTRY_H
+#define HALIDE_EXPERIMENTS_PIPELINEREGISTRY_H
+
+#include <functional>
+#include <map>
+#include <memory>
+#include <ostream>
+#include <string>
+#include <vector>
+#include "Halide.h"
+#include "HalidePipeline.h"
+
+using namespace Halide;
+
+struct PipelineParameter {
+    std::string name;
+    double defaultValue;
+    std::string description;
+    bool isInteger = false;
+    // Rejects zero and negative values.
+    bool isPositive = false;
+    // Rejects even values, e.g., of widths centered on a pixel; implies isInteger.
+    bool isOdd = false;
+};
+
+// Values of all the parameters of a pipeline, defaults included.
+using PipelineParameters = std::map<std::string, double>;
+
+struct PipelineDescription {
+    std::string name;
+    std::string description;
+    std::vector<PipelineParameter> parameters;
+    // 1 for gray images, 3 for color images.
+    int inputChannels;
+    int outputChannels;
+    // Named CPU schedules; the first one is the default.
+    std::vector<std::string> scheduleVariants = {"default"};
+    /**
+     * Creates the pipeline for the given pixel type. The upstream
+     * pipeline is null unless the pipeline is chained after another one.
+     */
+    std::function<std::shared_ptr<HalidePipeline>(const Type &pixelType,
+                                                  const PipelineParameters &parameters,
+                                                  std::shared_ptr<HalidePipeline> upstream)> create;
+};
+
+/**
+ * Pipelines by name. Each pipeline registers itself from its own
+ * translation unit with a static PipelineRegistry::Registration.
+ */
+class PipelineRegistry {
+private:
+    std::map<std::string, PipelineDescription> descriptions;
+
+    PipelineRegistry() = default;
+
+public:
+    struct Registration {
+        explicit Registration(PipelineDescription description);
+    };
+
+    static PipelineRegistry &instance();
+
+    const PipelineDescription &find(const std::string &name) const;
+
+    std::vector<const PipelineDescription *> list() const;
+
+    /**
+     * Creates a pipeline or a chain of pipelines separated by '+'
+     * (e.g., "colortogray+nonlocalmeans"). Parameters are given as
+     * "name=value", or "pipeline.name=value" to set only one pipeline's
+     * parameter in a chain. The schedule variant applies to the last
+     * pipeline, which schedules the whole chain.
+     * @throws std::invalid_argument on an unknown pipeline, parameter
+     * or schedule variant, on a value that is not a finite number or that
+     * the parameter does not allow, or when the channels of a chain do not match.
+     */
+    std::shared_ptr<HalidePipeline> create(const std::string &chain, const Type &pixelType,
+                                           const std::vector<std::string> &assignments = {},
+                                           const std::string &scheduleVariant = "") const;
+
+    // The number of channels the first pipeline of a chain expects.
+    int inputChannels(const std::string &chain) const;
+
+    void printUsage(std::ostream &stream) const;
+};
+
+#endif //HALIDE_EXPERIMENTS_PIPELINEREGISTRY_H
@@ -0,0 +1,52 @@
+
+#ifndef HALIDE_EXPERIMENTS_PIXELTRAITS_H
+#define HALIDE_EXPERIMENTS_PIXELTRAITS_H
+
+#include <cstdint>
+#include <sstream>
+#include <stdexcept>
+#include "Halide.h"
+
+/**
+ * Per pixel type: the value of a fully saturated sample (which maps to 1
+ * in normalized computations). The pipelines compute in float for every
+ * pixel type: its 24-bit mantissa represents 8- and 16-bit samples exactly,
+ * and it is the widest type all targets vectorize (Metal has no double).
+ */
+template<typename T>
+struct PixelTraits;
+
+template<>
+struct PixelTraits<uint8_t> {
+    static constexpr float maxValue = 255.0f;
+};
+
+template<>
+struct PixelTraits<uint16_t> {
+    static constexpr float maxValue = 65535.0f;
+};
+
+template<>
+struct PixelTraits<float> {
+    static constexpr float maxValue = 1.0f;
+};
+
+/**
+ * Calls f with a value of the C++ type of the given pixel type,
+ * e.g. to pick the instantiation of a pipeline template.
+ */
+template<typename F>
+auto dispatchPixelType(const Halide::Type &type, F &&f) {
+    if (type == Halide::UInt(8)) {
+        return f(uint8_t());
+    } else if (type == Halide::UInt(16)) {
+        return f(uint16_t());
+    } else if (type == Halide::Float(32)) {
+        return f(float());
+    }
+    std::ostringstream message;
+    message << "Unsupported pixel type: " << type;
+    throw std::invalid_argument(message.str());
+}
+
+#endif //HALIDE_EXPERIMENTS_PIXELTRAITS_H
@@ -0,0 +1,60 @@
+
+#ifndef HALIDE_EXPERIMENTS_SCHEDULEFILE_H
+#define HALIDE_EXPERIMENTS_SCHEDULEFILE_H
+
+#include <map>
+#include <string>
+#include <vector>
+#include "Halide.h"
+#include "HalidePipeline.h"
+
+using namespace Halide;
+
+/**
+ * A schedule described in a text file, applied instead of the pipeline's
+ * own one. Each line holds one directive for one Func of the pipeline
+ * (see HalidePipeline::funcs()), e.g.:
+ *
+ *     # Tiles of 4x4 pixels, processed in parallel
+ *     gaussian compute_root
+ *     result tile x y xo yo xi yi 4 4
+ *     result fuse xo yo tileIndex
+ *     result parallel tileIndex
+ *     neighborhoodWeight compute_at result xi
+ *
+ * Directives: tile, split, fuse, reorder, vectorize, unroll, parallel,
+ * gpu_tile, gpu_blocks, gpu_threads, compute_root, compute_at, compute_with,
+ * compute_inline, store_root and store_at. Vars are referred to by name;
+ * the directives apply to the pure definitions of the Funcs.
+ */
+class ScheduleFile {
+private:
+    struct Directive {
+        int line;
+        std::string func;
+        std::string name;
+        std::vector<std::string> arguments;
+    };
+
+    std::string path;
+    std::vector<Directive> directives;
+
+    [[noreturn]] void fail(const Directive &directive, const std::string &message) const;
+
+    void apply(const Directive &directive, const std::map<std::string, Func> &funcs) const;
+
+public:
+    /**
+     * Parses the file.
+     * @throws std::invalid_argument if it cannot be read, or on an unknown
+     * directive or a wrong number of arguments.
+     */
+    explicit ScheduleFile(const std::string &path);
+
+    /**
+     * @throws std::invalid_argument on an unknown Func or an invalid argument.
+     */
+    void apply(HalidePipeline &pipeline) const;
+};
+
+#endif //HALIDE_EXPERIMENTS_SCHEDULEFILE_H
@@ -0,0 +1,27 @@
+
+#ifndef HALIDE_EXPERIMENTS_PNGWRITER_H
+#define HALIDE_EXPERIMENTS_PNGWRITER_H
+
+#include <string>
+#include "Halide.h"
+#include "imaging.h"
+
+using namespace Halide;
+
+/**
+ * Encodes a PNG on multiple threads. The image is split into strips of rows
+ * that are filtered and deflated independently; every strip but the last ends
+ * with a sync flush, so the compressed strips concatenate into a single valid
+ * zlib stream. Each strip is written as its own IDAT chunk.
+ *
+ * The strips are encoded on the current WorkStealingPool if there is one,
+ * otherwise on threads of their own; a single strip, on the calling thread.
+ *
+ * Expects interleaved rows (any row stride) of 8- or 16-bit unsigned samples.
+ * Returns false on failure.
+ * Only available when built with zlib (HALIDE_EXPERIMENTS_WITH_ZLIB).
+ */
+bool writePngParallel(const Buffer<> &image, const std::string &targetFilePath,
+                      const PngOptions &pngOptions);
+
+#endif //HALIDE_EXPERIMENTS_PNGWRITER_H
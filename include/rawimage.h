@@ -0,0 +1,80 @@
+
+#ifndef HALIDE_EXPERIMENTS_RAWIMAGE_H
+#define HALIDE_EXPERIMENTS_RAWIMAGE_H
+
+#include <cstdint>
+#include <string>
+#include "Halide.h"
+#include "imaging.h"
+
+using namespace Halide;
+
+// File extension of the raw image container.
+constexpr const char *rawImageExtension = ".hlraw";
+
+// Reads as 0x04030201 on a machine of the other byte order.
+constexpr uint32_t rawImageByteOrderMark = 0x01020304;
+
+constexpr int rawImageMaxDimensions = 4;
+
+/**
+ * Header of the raw image container. The pixels follow at payloadOffset
+ * exactly as they are laid out in memory, so that loading the file takes
+ * neither decoding nor copying: the mapped file is the buffer. All values,
+ * the pixels included, are in the byte order of the machine that wrote
+ * the file, which byteOrderMark records; files of the other order are
+ * rejected rather than converted.
+ */
+struct RawImageHeader {
+    char magic[8];
+    uint32_t version;
+    // rawImageByteOrderMark as written by the saving machine
+    uint32_t byteOrderMark;
+    // halide_type_t of the pixels
+    uint8_t typeCode;
+    uint8_t typeBits;
+    uint16_t dimensions;
+    // Shape of each dimension; strides are in elements.
+    int32_t mins[rawImageMaxDimensions];
+    int32_t extents[rawImageMaxDimensions];
+    int32_t strides[rawImageMaxDimensions];
+    // The payload starts at a multiple of the alignment (in bytes).
+    uint32_t alignment;
+    // Offset of the element at the mins, relative to the payload start (in bytes).
+    uint32_t originOffset;
+    uint64_t payloadOffset;
+    uint64_t payloadSize;
+};
+
+bool isRawImagePath(const std::string &filePath);
+
+/**
+ * Maps a raw image file as the storage of a buffer, with the layout it was
+ * saved with, row padding included. The buffer owns the mapping: it is
+ * unmapped once the last copy of the buffer is gone, and removing or
+ * replacing the file meanwhile leaves it intact. The mapping is private,
+ * so writes to the buffer do not reach the file. The page policy (see
+ * pages.h) does not apply; payloads that cannot be mapped as they are
+ * (saved with negative strides) are copied into a buffer that follows it.
+ *
+ * Throws std::runtime_error if the file is not a valid raw image.
+ */
+Buffer<> loadRawImage(const std::string &filePath);
+
+/**
+ * Returns the pixel type of a raw image file, reading its header only.
+ *
+ * Throws std::runtime_error if the file is not a valid raw image.
+ */
+Type probeRawPixelType(const std::string &filePath);
+
+/**
+ * Writes the image into a raw image file, keeping its memory layout.
+ * The payload is aligned to a page, so that the mapped rows keep
+ * the alignment they had in memory.
+ *
+ * Throws std::runtime_error if the file cannot be written.
+ */
+void saveRawImage(const Buffer<> &image, const std::string &targetFilePath);
+
+#endif //HALIDE_EXPERIMENTS_RAWIMAGE_H
@@ -0,0 +1,170 @@
+
+#ifndef HALIDE_EXPERIMENTS_STATISTICS_H
+#define HALIDE_EXPERIMENTS_STATISTICS_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "PerfCounters.h"
+
+struct BatchReport {
+    size_t processedImages = 0;
+    uint64_t processedPixels = 0;
+    // Wall-clock time of the whole batch, in seconds
+    double elapsedTime = 0;
+    // Per image, from the start of decoding to the end of encoding, in seconds
+    std::vector<double> latencies;
+};
+
+struct ScheduleTiming {
+    std::string schedule;
+    // Mean over the measured reps, in seconds
+    double executionTime;
+    // Hardware event counts per rep, if collected
+    PerfCounts counts;
+};
+
+/**
+ * Returns the value below which the given fraction of the samples falls
+ * (nearest-rank). The samples are sorted in place.
+ */
+double percentile(std::vector<double> &samples, double fraction);
+
+/**
+ * Prints the throughput (images/s, megapixels/s), latency percentiles
+ * and a histogram of the per-image latencies.
+ */
+void printBatchReport(const BatchReport &report);
+
+/**
+ * Prints a histogram of latencies (in seconds) with power-of-two
+ * millisecond buckets.
+ */
+void printLatencyHistogram(const std::vector<double> &latencies);
+
+/**
+ * Prints the execution times of schedules as a Markdown table,
+ * in the format of the README, with the fastest one in bold.
+ * Where hardware events were counted, the IPC and the L1D, LLC and
+ * dTLB misses per thousand instructions follow.
+ */
+void printScheduleTable(const std::vector<ScheduleTiming> &timings);
+
+/**
+ * Prints hardware event counts per rep, with the IPC and the misses per
+ * thousand instructions derived from them, or why they are missing.
+ */
+void printPerfCounts(const PerfCounts &counts);
+
+struct CallOverheadTiming {
+    int size;
+    // Mean per call, in seconds
+    double realizeTime;
+    double callableTime;
+};
+
+/**
+ * Prints the per-call times of Func::realize() and of a Callable
+ * for square images of several sizes as a Markdown table.
+ */
+void printCallOverheadTable(const std::vector<CallOverheadTiming> &timings);
+
+struct PagePolicyTiming {
+    std::string policy;
+    // Of the input and output buffers, prefaulting included, in seconds
+    double allocationTime;
+    // The first run on the buffers, in seconds
+    double warmupTime;
+    uint64_t warmupPageFaults;
+    // Mean over the measured reps, in seconds
+    double executionTime;
+    // -1 where the counter is not available
+    int64_t tlbMissesPerRep;
+    // Allocations asking for reserved huge pages that got transparent ones
+    uint64_t hugetlbFallbacks;
+};
+
+/**
+ * Prints the allocation, warm-up and execution times, page faults
+ * and TLB misses of page policies as a Markdown table.
+ */
+void printPagePolicyTable(const std::vector<PagePolicyTiming> &timings);
+
+// The work of one run of a pipeline, after its cost model
+struct PipelineCost {
+    uint64_t pixels;
+    double bytesPerPixel;
+    double operationsPerPixel;
+};
+
+struct MachinePeaks {
+    // In bytes and operations per second; 0 if not measured
+    double memoryBandwidth = 0;
+    double operationRate = 0;
+};
+
+/**
+ * Prints the megapixels/s, GB/s and GFLOP/s of a run and, given the
+ * machine's peaks, how close it comes to the roofline: the operation rate
+ * its arithmetic intensity allows at the peak bandwidth, capped by the
+ * peak operation rate.
+ */
+void printThroughput(const PipelineCost &cost, double executionTime, const MachinePeaks &peaks);
+
+/**
+ * Prints the throughput of each schedule as a Markdown table, with the
+ * fraction of the roofline it reaches if the peaks were measured.
+ */
+void printRooflineTable(const std::vector<ScheduleTiming> &timings, const PipelineCost &cost,
+                        const MachinePeaks &peaks);
+
+struct ScalingTiming {
+    int threads;
+    // Mean over the measured reps, in seconds
+    double executionTime;
+    // Of a STREAM triad on as many threads, in bytes per second
+    double memoryBandwidth;
+};
+
+/**
+ * Prints the speedup and parallel efficiency over one thread of each
+ * thread count as a Markdown table, followed by the thread count from
+ * which the memory bandwidth is saturated (90% of its peak).
+ */
+void printScalingReport(const std::vector<ScalingTiming> &timings);
+
+struct ArenaStatistics {
+    // Allocations served from freed blocks, and the bytes requested by them
+    uint64_t reusedBlocks = 0;
+    uint64_t reusedBytes = 0;
+    // Allocations served by mapping new memory
+    uint64_t freshBlocks = 0;
+    uint64_t freshBytes = 0;
+    // Held in free lists at the time of the report
+    uint64_t retainedBytes = 0;
+};
+
+/**
+ * Prints how many of the allocations of a BufferArena, and how many
+ * bytes, were served from reuse versus fresh memory.
+ */
+void printArenaStatistics(const ArenaStatistics &statistics);
+
+// The tasks of one parallel loop of a WorkStealingPool, in seconds
+struct LoopLoad {
+    double wallTime = 0;
+    // Per worker, then a last slot for the threads that are not workers of the pool
+    std::vector<double> busyTimes;
+    std::vector<double> taskTimes;
+};
+
+/**
+ * Prints the distribution of the task durations of parallel loops, the
+ * busy and idle time of each thread within them, and how unbalanced the
+ * loops were: the busiest thread's time over the mean one's, weighted by
+ * the loop times, and the busy fraction of the threads' time.
+ */
+void printLoadReport(const std::vector<LoopLoad> &loops);
+
+#endif //HALIDE_EXPERIMENTS_STATISTICS_H
@@ -2,44 +2,145 @@
 #include "Halide.h"
 #include <random>
 #include <chrono>
-#include <unistd.h> // for getopt
+#include <filesystem>
+#include <sstream>
+#include <cstring>
+#include <exception>
+#include <thread>
+#include <getopt.h> // for getopt_long
 
 #include "lib/stb/stb_image.h"
 #include "lib/stb/stb_image_write.h"
-#include "pipelines/NonlocalMeansFilter.h"
 #include "target.h"
-#include "pipelines/ColorToGrayConverter.h"
+#include "pipelines/PipelineRegistry.h"
+#include "pipelines/ScheduleFile.h"
 #include "imaging.h"
+#include "DecodedImageCache.h"
+#include "rawimage.h"
+#include "BatchProcessor.h"
+#include "imagelist.h"
+#include "DebugDump.h"
+#include "statistics.h"
+#include "WorkStealingPool.h"
+#include "NumaExecutor.h"
+#include "BufferArena.h"
+#include "pages.h"
+#include "PerfCounters.h"
+#include "machine.h"
+#include "Tracer.h"
 
 using namespace Halide;
 
 struct Arguments {
-    std::string imagePath;
+    // Images, directories, glob patterns or @lists of images.
+    // More than one image runs the batch mode.
+    std::vector<std::string> imagePaths;
+    std::string outputPath = "outputs/output.png";
+    // A pipeline name or a chain of them, e.g. "colortogray+nonlocalmeans".
     std::string pipelineType;
+    // Pipeline parameters as [pipeline.]name=value.
+    std::vector<std::string> pipelineParameters;
+    std::string scheduleVariant;
+    // Replaces the pipeline's own schedule (see ScheduleFile).
+    std::string scheduleFile;
+    // Benchmarks all the schedule variants instead of running one.
+    bool benchmarkAll = false;
+    // Runs the pipeline through a Callable instead of Func::realize().
+    bool useCallable = false;
+    // Compares the per-call overhead of both on small images.
+    bool benchmarkOverhead = false;
+    // Processes copies of the image on this many threads at once (0 for off).
+    int concurrentThreads = 0;
+    // Workers of the work-stealing pool running the parallel loops
+    // (0 for one per core), or -1 for the Halide runtime's thread pool.
+    int poolThreads = -1;
+    // Runs the I/O of the batch mode on the same pool.
+    bool sharePool = false;
+    // Processes one band of the image per NUMA node, on that node.
+    bool numa = false;
+    // Recycles the pipelines' intermediate buffers (see BufferArena).
+    bool useArena = false;
+    // Huge pages and prefaulting of large buffers (see pages.h)
+    PagePolicy pagePolicy;
+    // Compares the page policies instead of running one.
+    bool benchmarkPages = false;
+    // Reruns the pipeline on 1 up to all cores.
+    bool benchmarkScaling = false;
+    // Counts hardware events (cycles, cache misses...) of each rep.
+    bool perfCounters = false;
+    // Measures the peak bandwidth and operation rate to compare the runs to.
+    bool roofline = false;
+    // Reports how evenly the tasks of the parallel loops load the pool's workers.
+    bool loadBalance = false;
+    // Writes a Chrome trace of the run to this path (see Tracer).
+    std::string tracePath;
     int reps = 1;
     std::string target;
+    bool alignRows = false;
+    std::string cacheDirectory;
+    uint64_t cacheSizeMegabytes = 1024;
+    PngOptions pngOptions;
+    BatchOptions batchOptions;
+    unsigned dumpArtifacts = DebugDump::Output;
+    std::string dumpDirectory = "outputs";
+    std::vector<std::string> dumpStages;
+    // Lists the registered pipelines instead of running one.
+    bool listPipelines = false;
     bool areValid = false;
 };
 
 Arguments processArguments(int argc, char **argv);
 
-void processHalide(const std::string &imagePath, int reps,
-                   const std::string &pipelineType, const std::string &targetType);
+void printUsage(const char *program);
+
+void processHalide(const Arguments &args);
+
+void processImages(const Arguments &args, const Target &target);
+
+void processBatch(const Arguments &args, const Target &target);
+
+std::function<Buffer<>(const std::string &)> createImageLoader(const Arguments &args);
 
 Target getTarget(const std::string &targetType);
 
-std::shared_ptr<HalidePipeline> createPipeline(const std::string &pipelineType,
-                                               const Buffer<uint8_t> &image);
+std::shared_ptr<HalidePipeline> createPipeline(const Arguments &args, const Type &pixelType);
+
+void installHandlers(const std::shared_ptr<HalidePipeline> &pipeline);
+
+void schedulePipeline(const std::shared_ptr<HalidePipeline> &pipeline, const Target &target,
+                      const std::string &scheduleFile);
+
+Buffer<> runPipeline(std::shared_ptr<HalidePipeline> pipeline,
+                     const Buffer<> &image,
+                     const Target &target, const Arguments &args, const MachinePeaks &peaks);
+
+PipelineCost costOf(const std::shared_ptr<HalidePipeline> &pipeline, const Buffer<> &image);
+
+void benchmarkSchedules(const Arguments &args, const Buffer<> &image, const Target &target,
+                        const MachinePeaks &peaks);
+
+void benchmarkCallOverhead(const Arguments &args, const Buffer<> &image, const Target &target);
+
+void benchmarkPagePolicies(const Arguments &args, const Buffer<> &image, const Target &target);
+
+void benchmarkThreadScaling(const Arguments &args, const Buffer<> &image, const Target &target);
+
+void runConcurrently(const std::shared_ptr<HalidePipeline> &pipeline, const Buffer<> &image,
+                     const Target &target, int reps, int threadCount);
 
-Buffer<uint8_t> runPipeline(std::shared_ptr<HalidePipeline> pipeline,
-                            const Buffer<uint8_t> &image,
-                            const Target &target, int reps);
+Buffer<> runOnNumaNodes(const std::shared_ptr<HalidePipeline> &pipeline, const Buffer<> &image,
+                        const Target &target, int reps, const MachinePeaks &peaks);
 
 void printPipelineSchedule(const std::shared_ptr<HalidePipeline> &pipeline);
 
+void printFirstRun(double firstRunTime, uint64_t pageFaults, double steadyStateTime);
+
 template<typename Func>
 double measureExecutionTime(Func &&func);
 
+template<typename Func>
+double measureWithCounters(Func &&func, int reps, PerfCounts &counts);
+
 void printCurrentTime();
 
 int main(int argc, char **argv) {
@@ -47,13 +148,23 @@ int main(int argc, char **argv) {
     if (!args.areValid) {
         return EXIT_FAILURE;
     }
+    if (args.listPipelines) {
+        PipelineRegistry::instance().printUsage(std::cout);
+        return EXIT_SUCCESS;
+    }
 
     try {
-        processHalide(args.imagePath, args.reps, args.pipelineType, args.target);
+        processHalide(args);
     } catch (CompileError &e) {
         std::cout << e.what() << std::endl;
     } catch (RuntimeError &e) {
         std::cout << e.what() << std::endl;
+    } catch (std::runtime_error &e) {
+        std::cerr << e.what() << std::endl;
+        return EXIT_FAILURE;
+    } catch (std::invalid_argument &e) {
+        std::cerr << e.what() << std::endl;
+        return EXIT_FAILURE;
     }
 
     return EXIT_SUCCESS;
@@ -61,67 +172,457 @@ int main(int argc, char **argv) {
 
 Arguments processArguments(int argc, char **argv) {
     Arguments args;
+    enum LongOnlyOption {
+        AlignRows = 256,
+        CacheDirectory,
+        CacheSize,
+        PngLevel,
+        PngFilter,
+        PngThreads,
+        DecodeThreads,
+        EncodeThreads,
+        QueueDepth,
+        Dump,
+        DumpStage,
+        DumpDirectory,
+        Parameter,
+        Schedule,
+        ListPipelines,
+        BenchmarkAll,
+        ScheduleFilePath,
+        UseCallable,
+        BenchmarkOverhead,
+        ComputeThreads,
+        Concurrent,
+        ThreadPool,
+        SharePool,
+        Numa,
+        Arena,
+        HugePagesPolicy,
+        Prefault,
+        BenchmarkPages,
+        BenchmarkScaling,
+        CountEvents,
+        Roofline,
+        TracePath,
+        LoadBalance,
+    };
+    const option longOptions[] = {
+            {"image",      required_argument, nullptr, 'i'},
+            {"output",     required_argument, nullptr, 'o'},
+            {"reps",       required_argument, nullptr, 'r'},
+            {"pipeline",   required_argument, nullptr, 'p'},
+            {"target",     required_argument, nullptr, 't'},
+            {"align-rows", no_argument,       nullptr, AlignRows},
+            {"cache-dir",  required_argument, nullptr, CacheDirectory},
+            {"cache-size", required_argument, nullptr, CacheSize},
+            {"png-level",  required_argument, nullptr, PngLevel},
+            {"png-filter", required_argument, nullptr, PngFilter},
+            {"png-threads", required_argument, nullptr, PngThreads},
+            {"decode-threads", required_argument, nullptr, DecodeThreads},
+            {"encode-threads", required_argument, nullptr, EncodeThreads},
+            {"queue-depth", required_argument, nullptr, QueueDepth},
+            {"dump",       required_argument, nullptr, Dump},
+            {"dump-stage", required_argument, nullptr, DumpStage},
+            {"dump-dir",   required_argument, nullptr, DumpDirectory},
+            {"param",      required_argument, nullptr, Parameter},
+            {"schedule",   required_argument, nullptr, Schedule},
+            {"list-pipelines", no_argument,   nullptr, ListPipelines},
+            {"benchmark-all", no_argument,    nullptr, BenchmarkAll},
+            {"schedule-file", required_argument, nullptr, ScheduleFilePath},
+            {"callable",   no_argument,       nullptr, UseCallable},
+            {"benchmark-overhead", no_argument, nullptr, BenchmarkOverhead},
+            {"compute-threads", required_argument, nullptr, ComputeThreads},
+            {"concurrent", required_argument, nullptr, Concurrent},
+            {"thread-pool", required_argument, nullptr, ThreadPool},
+            {"share-pool", no_argument,       nullptr, SharePool},
+            {"numa",       no_argument,       nullptr, Numa},
+            {"arena",      no_argument,       nullptr, Arena},
+            {"huge-pages", required_argument, nullptr, HugePagesPolicy},
+            {"prefault",   no_argument,       nullptr, Prefault},
+            {"benchmark-pages", no_argument,  nullptr, BenchmarkPages},
+            {"benchmark-scaling", no_argument, nullptr, BenchmarkScaling},
+            {"perf-counters", no_argument,    nullptr, CountEvents},
+            {"roofline",   no_argument,       nullptr, Roofline},
+            {"trace",      required_argument, nullptr, TracePath},
+            {"load-balance", no_argument,     nullptr, LoadBalance},
+            {nullptr, 0,                      nullptr, 0}
+    };
     int opt;
-    while ((opt = getopt(argc, argv, "i:r:p:t:")) != -1) {
-        switch (opt) {
-            case 'i':
-                args.imagePath = optarg;
-                break;
-            case 'r':
-                args.reps = std::stoi(optarg);
-                break;
-            case 'p':
-                args.pipelineType = optarg;
-                break;
-            case 't':
-                args.target = optarg;
-                break;
-            default:
-                std::cerr << "Usage: " << argv[0] << " -i <image_path> -r <reps> -p <pipeline_type> -t <target>"
-                          << std::endl;
-                return args;
-        }
-    }
-    if (args.imagePath.empty() || args.pipelineType.empty()) {
+    bool isPngThreadsSet = false;
+    try {
+        while ((opt = getopt_long(argc, argv, "i:o:r:p:t:", longOptions, nullptr)) != -1) {
+            switch (opt) {
+                case 'i':
+                    args.imagePaths.emplace_back(optarg);
+                    break;
+                case 'o':
+                    args.outputPath = optarg;
+                    break;
+                case 'r':
+                    args.reps = std::stoi(optarg);
+                    break;
+                case 'p':
+                    args.pipelineType = optarg;
+                    break;
+                case 't':
+                    args.target = optarg;
+                    break;
+                case AlignRows:
+                    args.alignRows = true;
+                    break;
+                case CacheDirectory:
+                    args.cacheDirectory = optarg;
+                    break;
+                case CacheSize:
+                    args.cacheSizeMegabytes = std::stoull(optarg);
+                    break;
+                case PngLevel:
+                    args.pngOptions.compressionLevel = std::stoi(optarg);
+                    break;
+                case PngFilter:
+                    args.pngOptions.filter = std::stoi(optarg);
+                    break;
+                case PngThreads:
+                    args.pngOptions.threads = std::stoi(optarg);
+                    isPngThreadsSet = true;
+                    break;
+                case DecodeThreads:
+                    args.batchOptions.decodeThreads = std::stoi(optarg);
+                    break;
+                case EncodeThreads:
+                    args.batchOptions.encodeThreads = std::stoi(optarg);
+                    break;
+                case QueueDepth:
+                    args.batchOptions.queueDepth = std::stoi(optarg);
+                    break;
+                case Dump:
+                    args.dumpArtifacts = DebugDump::parseArtifacts(optarg);
+                    break;
+                case DumpStage:
+                    args.dumpStages.emplace_back(optarg);
+                    break;
+                case DumpDirectory:
+                    args.dumpDirectory = optarg;
+                    break;
+                case Parameter:
+                    args.pipelineParameters.emplace_back(optarg);
+                    break;
+                case Schedule:
+                    args.scheduleVariant = optarg;
+                    break;
+                case ListPipelines:
+                    args.listPipelines = true;
+                    break;
+                case BenchmarkAll:
+                    args.benchmarkAll = true;
+                    break;
+                case ScheduleFilePath:
+                    args.scheduleFile = optarg;
+                    break;
+                case UseCallable:
+                    args.useCallable = true;
+                    break;
+                case BenchmarkOverhead:
+                    args.benchmarkOverhead = true;
+                    break;
+                case ComputeThreads:
+                    args.batchOptions.computeThreads = std::stoi(optarg);
+                    break;
+                case Concurrent:
+                    args.concurrentThreads = std::stoi(optarg);
+                    break;
+                case ThreadPool:
+                    args.poolThreads = std::stoi(optarg);
+                    break;
+                case SharePool:
+                    args.sharePool = true;
+                    break;
+                case Numa:
+                    args.numa = true;
+                    break;
+                case Arena:
+                    args.useArena = true;
+                    break;
+                case HugePagesPolicy:
+                    args.pagePolicy.hugePages = parseHugePages(optarg);
+                    break;
+                case Prefault:
+                    args.pagePolicy.prefault = true;
+                    break;
+                case BenchmarkPages:
+                    args.benchmarkPages = true;
+                    break;
+                case BenchmarkScaling:
+                    args.benchmarkScaling = true;
+                    break;
+                case CountEvents:
+                    args.perfCounters = true;
+                    break;
+                case Roofline:
+                    args.roofline = true;
+                    break;
+                case TracePath:
+                    args.tracePath = optarg;
+                    break;
+                case LoadBalance:
+                    args.loadBalance = true;
+                    break;
+                default:
+                    printUsage(argv[0]);
+                    return args;
+            }
+        }
+    } catch (std::logic_error &e) {
+        // The values that do not parse: std::invalid_argument, or std::out_of_range from std::stoi.
+        std::cerr << "Invalid option value (" << e.what() << ")." << std::endl;
+        printUsage(argv[0]);
+        return args;
+    }
+    // Nothing else is needed to list the pipelines.
+    if (args.listPipelines) {
+        args.areValid = true;
+        return args;
+    }
+    if (args.imagePaths.empty() || args.pipelineType.empty()) {
         std::cerr << "Both --image and --pipeline arguments are required." << std::endl;
         return args;
     }
+    if (args.pngOptions.threads < 0) {
+        std::cerr << "--png-threads must not be negative." << std::endl;
+        return args;
+    }
+    if (args.pngOptions.compressionLevel < 0 || args.pngOptions.compressionLevel > 9) {
+        std::cerr << "--png-level must be between 0 and 9." << std::endl;
+        return args;
+    }
+    if (args.pngOptions.filter < -1 || args.pngOptions.filter > 4) {
+        std::cerr << "--png-filter must be between -1 (adaptive) and 4 (Paeth)." << std::endl;
+        return args;
+    }
+    if (args.batchOptions.decodeThreads < 1 || args.batchOptions.encodeThreads < 1 ||
+        args.batchOptions.computeThreads < 1 || args.batchOptions.queueDepth < 1) {
+        std::cerr << "--decode-threads, --compute-threads, --encode-threads and --queue-depth must be positive."
+                  << std::endl;
+        return args;
+    }
+    if (args.concurrentThreads < 0) {
+        std::cerr << "--concurrent must not be negative." << std::endl;
+        return args;
+    }
+    if (args.sharePool && args.poolThreads < 0) {
+        std::cerr << "--share-pool requires --thread-pool." << std::endl;
+        return args;
+    }
+    // The tasks are timed by the pool dispatching them.
+    if (args.loadBalance && args.poolThreads < 0) {
+        std::cerr << "--load-balance requires --thread-pool." << std::endl;
+        return args;
+    }
     if (args.target != "cpu" && args.target != "gpu") {
         std::cerr << "--target (-t) must be one of [gpu, cpu]." << std::endl;
         return args;
     }
+    if ((args.benchmarkAll || args.benchmarkOverhead || args.benchmarkPages || args.benchmarkScaling) &&
+        args.target != "cpu") {
+        std::cerr << "The --benchmark-* modes require --target cpu." << std::endl;
+        return args;
+    }
+    // It runs on pools of its own.
+    if (args.benchmarkScaling && args.poolThreads >= 0) {
+        std::cerr << "--benchmark-scaling cannot be combined with --thread-pool." << std::endl;
+        return args;
+    }
+    if (args.numa && (args.target != "cpu" || args.concurrentThreads > 0)) {
+        std::cerr << "--numa requires --target cpu and cannot be combined with --concurrent." << std::endl;
+        return args;
+    }
+    // The peaks are those of the cores.
+    if (args.roofline && args.target != "cpu") {
+        std::cerr << "--roofline requires --target cpu." << std::endl;
+        return args;
+    }
+    // Recycled blocks would move between the nodes, or keep the pages of the previous policy.
+    if (args.useArena && (args.numa || args.benchmarkPages)) {
+        std::cerr << "--arena cannot be combined with --numa or --benchmark-pages." << std::endl;
+        return args;
+    }
+    // In the batch mode, -o gives the output directory and format.
+    std::filesystem::path outputPath(args.outputPath);
+    args.batchOptions.outputDirectory = outputPath.has_parent_path() ? outputPath.parent_path().string() : ".";
+    args.batchOptions.outputExtension = outputPath.extension().string();
+    args.batchOptions.pngOptions = args.pngOptions;
+    // The encode threads already run in parallel, one image each.
+    if (!isPngThreadsSet) {
+        args.batchOptions.pngOptions.threads = 1;
+    }
+    args.batchOptions.saveOutputs = args.dumpArtifacts & DebugDump::Output;
     args.areValid = true;
     return args;
 }
 
 
-void processHalide(const std::string &imagePath, int reps,
-                   const std::string &pipelineType, const std::string &targetType) {
+void printUsage(const char *program) {
+    std::cerr << "Usage: " << program << " -i <image_path> -r <reps> -p <pipeline_type> -t <target>"
+              << " [-o <output_path>] [--align-rows]"
+              << " [--cache-dir <dir> [--cache-size <MB>]]"
+              << " [--png-level <0..9>] [--png-filter <-1..4>] [--png-threads <n>]"
+              << " [--decode-threads <n>] [--encode-threads <n>] [--queue-depth <n>]"
+              << " [--dump <none|input|intermediates|output|all>,...] [--dump-stage <stage>]"
+              << " [--dump-dir <dir>] [--param [<pipeline>.]<name>=<value>] [--schedule <variant>]"
+              << " [--schedule-file <path>] [--list-pipelines] [--benchmark-all]"
+              << " [--callable] [--benchmark-overhead] [--compute-threads <n>] [--concurrent <n>]"
+              << " [--thread-pool <n> [--share-pool]] [--numa]"
+              << " [--arena] [--huge-pages <none|thp|hugetlb>] [--prefault] [--benchmark-pages]"
+              << " [--benchmark-scaling] [--perf-counters] [--roofline]"
+              << " [--trace <path.json>] [--load-balance]" << std::endl
+              << "The intermediates are recomputed after the timed reps by a reference instance of the"
+              << " pipeline, realizing each stage on its own: they show what the stages compute, not how"
+              << " fast the schedule computes them. The batch mode only saves the outputs." << std::endl;
+}
+
+void processHalide(const Arguments &args) {
 //    int imageSize = 20;
 //    float gaussianNoiseSigma = 20.f;
 //    auto image = createNoisyImage(imageSize, gaussianNoiseSigma);
-    auto target = getTarget(targetType);
+    auto target = getTarget(args.target);
+    setPagePolicy(args.pagePolicy);
+
+    // Pipelines called from now on run their parallel loops on the pool.
+    std::unique_ptr<WorkStealingPool> pool;
+    if (args.poolThreads >= 0) {
+        pool = std::make_unique<WorkStealingPool>(args.poolThreads);
+        std::cout << "Running parallel loops on " << pool->threadCount() << " pinned workers" << std::endl;
+    }
+    // Likewise, their heap allocations are recycled by the arena.
+    std::unique_ptr<BufferArena> arena;
+    if (args.useArena) {
+        arena = std::make_unique<BufferArena>();
+    }
+    // And their realizations are traced.
+    std::unique_ptr<Tracer> tracer;
+    if (!args.tracePath.empty()) {
+        tracer = std::make_unique<Tracer>();
+    }
+
+    processImages(args, target);
+
+    if (arena) {
+        printArenaStatistics(arena->statistics());
+    }
+    if (tracer) {
+        tracer->write(args.tracePath);
+        std::cout << "Wrote " << tracer->eventCount() << " spans to " << args.tracePath
+                  << " (open it in ui.perfetto.dev)" << std::endl;
+    }
+}
+
+void processImages(const Arguments &args, const Target &target) {
+    if (args.imagePaths.size() > 1 || isImageCollection(args.imagePaths.front())) {
+        processBatch(args, target);
+        return;
+    }
+
+    DebugDump dump(args.dumpArtifacts, args.dumpDirectory, args.dumpStages);
 
     std::cout << "Preparing input image..." << std::endl;
-    auto image = loadImageFromFile(imagePath);
-    saveImageToFile(image, "outputs/input.png");
+    // Its memory follows the page policy already.
+    Buffer<> image;
+    {
+        Tracer::Span span("io", "decode", args.imagePaths.front());
+        image = createImageLoader(args)(args.imagePaths.front());
+    }
+    if (dump.isEnabled(DebugDump::Input)) {
+        dump.dumpInput(image);
+    }
 
     std::cout << "Instantiating pipeline..." << std::endl;
-    auto pipeline = createPipeline(pipelineType, image);
+    int inputChannels = PipelineRegistry::instance().inputChannels(args.pipelineType);
+    if (image.channels() != inputChannels) {
+        throw std::runtime_error(args.pipelineType + " expects images with " +
+                                 std::to_string(inputChannels) + " channel(s)");
+    }
+    MachinePeaks peaks;
+    if (args.roofline) {
+        std::cout << "Measuring the peak memory bandwidth and operation rate..." << std::endl;
+        peaks = measureMachinePeaks(target);
+    }
+    if (args.benchmarkAll) {
+        benchmarkSchedules(args, image, target, peaks);
+        return;
+    }
+    if (args.benchmarkOverhead) {
+        benchmarkCallOverhead(args, image, target);
+        return;
+    }
+    if (args.benchmarkPages) {
+        benchmarkPagePolicies(args, image, target);
+        return;
+    }
+    if (args.benchmarkScaling) {
+        benchmarkThreadScaling(args, image, target);
+        return;
+    }
+    auto pipeline = createPipeline(args, image.type());
+    dump.checkStages(*pipeline);
+    schedulePipeline(pipeline, target, args.scheduleFile);
 
-    if (target.has_gpu_feature()) {
-        std::cout << "Running pipeline on the GPU..." << std::endl;
-        pipeline->scheduleForGPU();
-    } else {
-        std::cout << "Running pipeline on the CPU..." << std::endl;
-        pipeline->scheduleForCPU();
+    if (args.concurrentThreads > 0) {
+        runConcurrently(pipeline, image, target, args.reps, args.concurrentThreads);
+        return;
     }
-    printPipelineSchedule(pipeline);
+    auto outputBuffer = args.numa ? runOnNumaNodes(pipeline, image, target, args.reps, peaks)
+                                  : runPipeline(pipeline, image, target, args, peaks);
+
+    if (dump.isEnabled(DebugDump::Intermediates)) {
+        // A reference recompute, by a separate, unscheduled instance of the pipeline:
+        // the scheduled stages may only exist within the loops of their consumers.
+        dump.dumpStages(*createPipeline(args, image.type()), image, target);
+    }
+    if (dump.isEnabled(DebugDump::Output)) {
+        std::cout << "Saving result..." << std::endl;
+        Tracer::Span span("io", "encode", args.outputPath);
+        saveImageToFile(outputBuffer, args.outputPath, args.pngOptions);
+    }
+}
+
+void processBatch(const Arguments &args, const Target &target) {
+    std::vector<std::string> imagePaths = expandImagePaths(args.imagePaths);
+    if ((args.dumpArtifacts & (DebugDump::Input | DebugDump::Intermediates)) || !args.dumpStages.empty()) {
+        std::cerr << "Warning: the batch mode only saves the outputs; the input and intermediates"
+                  << " asked for by --dump and --dump-stage are not dumped." << std::endl;
+    }
+
+    // One compiled pipeline serves the whole batch, so all images
+    // must share the pixel type of the first one.
+    std::cout << "Instantiating pipeline..." << std::endl;
+    auto pipeline = createPipeline(args, probePixelType(imagePaths.front()));
+    schedulePipeline(pipeline, target, args.scheduleFile);
 
-    auto outputBuffer = runPipeline(pipeline, image, target, reps);
+    BatchOptions options = args.batchOptions;
+    if (args.sharePool) {
+        options.ioPool = WorkStealingPool::current();
+    }
+
+    std::cout << "Processing " << imagePaths.size() << " images..." << std::endl;
+    BatchProcessor processor(pipeline, target, options, createImageLoader(args));
+    printBatchReport(processor.run(imagePaths));
+}
 
-    std::cout << "Saving result..." << std::endl;
-    saveImageToFile(outputBuffer, "outputs/output.png");
+std::function<Buffer<>(const std::string &)> createImageLoader(const Arguments &args) {
+    bool alignRows = args.alignRows;
+    if (args.cacheDirectory.empty()) {
+        return [alignRows](const std::string &imagePath) {
+            return loadImageFromFile(imagePath, alignRows);
+        };
+    }
+    auto cache = std::make_shared<DecodedImageCache>(args.cacheDirectory, args.cacheSizeMegabytes << 20);
+    return [cache, alignRows](const std::string &imagePath) {
+        if (isRawImagePath(imagePath)) {
+            return loadImageFromFile(imagePath, alignRows);
+        }
+        return cache->load(imagePath, alignRows);
+    };
 }
 
 Target getTarget(const std::string &targetType) {
@@ -141,59 +642,438 @@ Target getTarget(const std::string &targetType) {
 }
 
 
-std::shared_ptr<HalidePipeline> createPipeline(const std::string &pipelineType,
-                                               const Buffer<uint8_t> &image) {
-    int searchWindowSize = 13;
-    int patchSize = 5;
+std::shared_ptr<HalidePipeline> createPipeline(const Arguments &args, const Type &pixelType) {
+    auto pipeline = PipelineRegistry::instance().create(args.pipelineType, pixelType,
+                                                        args.pipelineParameters, args.scheduleVariant);
+    installHandlers(pipeline);
+    return pipeline;
+}
+
+void installHandlers(const std::shared_ptr<HalidePipeline> &pipeline) {
+    if (BufferArena::current() != nullptr) {
+        BufferArena::install(pipeline->result.jit_handlers());
+    } else if (!pagePolicy().isDefault()) {
+        installPagePolicy(pipeline->result.jit_handlers());
+    }
+    if (Tracer::current() != nullptr) {
+        Tracer::install(*pipeline);
+    }
+}
 
-    std::shared_ptr<HalidePipeline> pipeline;
-    if (pipelineType == "colortogray") {
-        assert(image.channels() == 3);
-        pipeline = std::make_shared<ColorToGrayConverter>(image);
-    } else if (pipelineType == "nonlocalmeans") {
-        assert(image.channels() == 1);
-        pipeline = std::make_shared<NonlocalMeansFilter>(image, patchSize, searchWindowSize);
+void schedulePipeline(const std::shared_ptr<HalidePipeline> &pipeline, const Target &target,
+                      const std::string &scheduleFile) {
+    if (!scheduleFile.empty()) {
+        std::cout << "Applying the schedule from " << scheduleFile << "..." << std::endl;
+        ScheduleFile(scheduleFile).apply(*pipeline);
+    } else if (target.has_gpu_feature()) {
+        std::cout << "Running pipeline on the GPU..." << std::endl;
+        pipeline->scheduleForGPU();
     } else {
-        std::cerr << "Invalid pipeline type: " << pipelineType << std::endl;
-        return nullptr;
+        std::cout << "Running pipeline on the CPU..." << std::endl;
+        pipeline->scheduleForCPU();
     }
-    return pipeline;
+    printPipelineSchedule(pipeline);
 }
 
-Buffer<uint8_t> runPipeline(std::shared_ptr<HalidePipeline> pipeline,
-                            const Buffer<uint8_t> &image,
-                            const Target &target, int reps) {
+Buffer<> runPipeline(std::shared_ptr<HalidePipeline> pipeline,
+                     const Buffer<> &image,
+                     const Target &target, const Arguments &args, const MachinePeaks &peaks) {
+    const int reps = args.reps;
     auto realizationWidth = image.width();
     auto realizationHeight = image.height();
 
-    auto outputBuffer = Halide::Buffer<uint8_t>(realizationWidth, realizationHeight);
+    auto outputBuffer = allocateBuffer(pipeline->result.output_type(), {realizationWidth, realizationHeight});
+    pipeline->input.set(image);
 
-    double warmupTime = measureExecutionTime([&pipeline, &outputBuffer, &target] {
-        // Warm-up before measuring
-        pipeline->result.realize(outputBuffer, target);
+    // Lowering alone, to break the compile time down. Compiling lowers the pipeline again.
+    double loweringTime = measureExecutionTime([&pipeline, &target] {
+        Tracer::Span span("pipeline", "lower");
+        pipeline->lower(target);
+    });
+    // Compiled before the first run, so that it is not part of its time. With a
+    // Callable, each call then goes straight to the compiled code.
+    Callable callable;
+    double compileTime = measureExecutionTime([&pipeline, &target, &args, &callable] {
+        Tracer::Span span("pipeline", "compile");
+        if (args.useCallable) {
+            callable = pipeline->compileToCallable(target);
+        } else {
+            pipeline->result.compile_jit(target);
+        }
+    });
+    auto realize = [&pipeline, &callable, &image, &outputBuffer, &target] {
+        WorkStealingPool::Context context(WorkStealingPool::current());
+        if (callable.defined()) {
+            checkCall(callable(context.get(), image, outputBuffer));
+        } else {
+            pipeline->result.realize(context.get(), outputBuffer, target);
+        }
+    };
+
+    // The first run touches the fresh pages of the buffers and warms up the caches.
+    uint64_t firstRunPageFaults = countPageFaults();
+    double firstRunTime = measureExecutionTime([&realize, &outputBuffer, &target] {
+        Tracer::Span span("pipeline", "first run");
+        realize();
 
         // Copy from GPU. Must be called, because the GPU runs asynchronously.
         if (target.has_gpu_feature()) {
+            Tracer::Span copySpan("copy", "copy to host");
             outputBuffer.copy_to_host();
         }
     });
-    double executionTime = measureExecutionTime([&pipeline, &outputBuffer, &reps, &target] {
-        for (int i = 0; i < reps; i++) {
-            pipeline->result.realize(outputBuffer, target);
+    firstRunPageFaults = countPageFaults() - firstRunPageFaults;
+    auto rep = [&realize, &outputBuffer, &target] {
+        Tracer::Span span("pipeline", "rep");
+        realize();
+
+        // Copy from GPU. Must be done for each rep, because the GPU runs asynchronously.
+        if (target.has_gpu_feature()) {
+            Tracer::Span copySpan("copy", "copy to host");
+            outputBuffer.copy_to_host();
+        }
+    };
+    WorkStealingPool *pool = args.loadBalance ? WorkStealingPool::current() : nullptr;
+    if (pool) {
+        pool->startMonitoring();
+    }
+    PerfCounts counts;
+    double executionTime;
+    if (args.perfCounters) {
+        executionTime = measureWithCounters(rep, reps, counts);
+    } else {
+        executionTime = measureExecutionTime([&rep, reps] {
+            for (int i = 0; i < reps; i++) {
+                rep();
+            }
+        });
+    }
+    std::vector<LoopLoad> loops;
+    if (pool) {
+        loops = pool->stopMonitoring();
+    }
+
+    std::cout << "Compile time: " << compileTime * 1000 << " ms (lowering " << loweringTime * 1000
+              << " ms, code generation and JIT linking " << std::max(0.0, compileTime - loweringTime) * 1000
+              << " ms)" << std::endl;
+    printFirstRun(firstRunTime, firstRunPageFaults, executionTime / reps);
+    std::cout << "Execution time: " << (executionTime / reps) * 1000 << " ms/rep" << std::endl;
+    printThroughput(costOf(pipeline, image), executionTime / reps, peaks);
+    if (args.perfCounters) {
+        printPerfCounts(counts);
+    }
+    if (pool) {
+        printLoadReport(loops);
+    }
 
-            // Copy from GPU. Must be done for each rep, because the GPU runs asynchronously.
+    return outputBuffer;
+}
+
+void runConcurrently(const std::shared_ptr<HalidePipeline> &pipeline, const Buffer<> &image,
+                     const Target &target, int reps, int threadCount) {
+    // The only thing the threads share.
+    Callable callable = pipeline->compileToCallable(target);
+    Type outputType = pipeline->result.output_type();
+
+    // Each thread has its own copy of the input and its own output.
+    std::vector<Buffer<>> inputs, outputs;
+    for (int i = 0; i < threadCount; i++) {
+        inputs.push_back(image.copy());
+        outputs.emplace_back(outputType, image.width(), image.height());
+    }
+    auto process = [&callable, &inputs, &outputs, &target, reps](int thread) {
+        for (int i = 0; i < reps; i++) {
+            WorkStealingPool::Context context(WorkStealingPool::current());
+            checkCall(callable(context.get(), inputs[thread], outputs[thread]));
             if (target.has_gpu_feature()) {
-                outputBuffer.copy_to_host();
+                outputs[thread].copy_to_host();
             }
         }
+    };
+
+    // The reference: the same images processed one after another.
+    double sequentialTime = measureExecutionTime([&process, threadCount] {
+        for (int thread = 0; thread < threadCount; thread++) {
+            process(thread);
+        }
+    });
+    Buffer<> reference = outputs[0].copy();
+    for (Buffer<> &output: outputs) {
+        // So that a result the concurrent run fails to write cannot pass.
+        memset(output.data(), 0, output.size_in_bytes());
+        output.set_host_dirty();
+    }
+
+    std::vector<std::exception_ptr> errors(threadCount);
+    double concurrentTime = measureExecutionTime([&process, &errors, threadCount] {
+        std::vector<std::thread> threads;
+        for (int thread = 0; thread < threadCount; thread++) {
+            threads.emplace_back([&process, &errors, thread] {
+                try {
+                    process(thread);
+                } catch (...) {
+                    errors[thread] = std::current_exception();
+                }
+            });
+        }
+        for (auto &thread: threads) {
+            thread.join();
+        }
+    });
+    for (const std::exception_ptr &error: errors) {
+        if (error) {
+            std::rethrow_exception(error);
+        }
+    }
+
+    int mismatches = 0;
+    for (const Buffer<> &output: outputs) {
+        mismatches += memcmp(output.data(), reference.data(), reference.size_in_bytes()) != 0;
+    }
+    if (mismatches > 0) {
+        throw std::runtime_error(std::to_string(mismatches) + " of " + std::to_string(threadCount) +
+                                 " concurrent results differ from the sequential one");
+    }
+
+    double images = (double) threadCount * reps;
+    std::cout << "Sequential: " << images / sequentialTime << " images/s" << std::endl;
+    std::cout << "Concurrent (" << threadCount << " threads): " << images / concurrentTime << " images/s, "
+              << sequentialTime / concurrentTime << "x" << std::endl;
+    std::cout << "Verified: all " << threadCount << " concurrent results match the sequential one." << std::endl;
+}
+
+Buffer<> runOnNumaNodes(const std::shared_ptr<HalidePipeline> &pipeline, const Buffer<> &image,
+                        const Target &target, int reps, const MachinePeaks &peaks) {
+    NumaExecutor executor(detectNumaNodes());
+    Callable callable;
+    double compileTime = measureExecutionTime([&pipeline, &target, &callable] {
+        Tracer::Span span("pipeline", "compile");
+        callable = pipeline->compileToCallable(target);
+    });
+    Type outputType = pipeline->result.output_type();
+
+    double distributionTime = measureExecutionTime([&executor, &image, &pipeline, &outputType] {
+        executor.distribute(image, pipeline->halo(), outputType);
+    });
+    executor.printBands(std::cout);
+
+    uint64_t firstRunPageFaults = countPageFaults();
+    double firstRunTime = measureExecutionTime([&executor, &callable] {
+        executor.run(callable);
+    });
+    firstRunPageFaults = countPageFaults() - firstRunPageFaults;
+    double executionTime = measureExecutionTime([&executor, &callable, reps] {
+        for (int i = 0; i < reps; i++) {
+            executor.run(callable);
+        }
     });
 
-    std::cout << "Warmup time: " << warmupTime * 1000 << " ms" << std::endl;
+    std::cout << "Compile time: " << compileTime * 1000 << " ms" << std::endl;
+    std::cout << "Distribution time: " << distributionTime * 1000 << " ms" << std::endl;
+    printFirstRun(firstRunTime, firstRunPageFaults, executionTime / reps);
     std::cout << "Execution time: " << (executionTime / reps) * 1000 << " ms/rep" << std::endl;
+    printThroughput(costOf(pipeline, image), executionTime / reps, peaks);
 
+    auto outputBuffer = Buffer<>(outputType, image.width(), image.height());
+    executor.gather(outputBuffer);
     return outputBuffer;
 }
 
+PipelineCost costOf(const std::shared_ptr<HalidePipeline> &pipeline, const Buffer<> &image) {
+    return {(uint64_t) image.width() * image.height(), pipeline->bytesPerPixel(), pipeline->operationsPerPixel()};
+}
+
+void benchmarkSchedules(const Arguments &args, const Buffer<> &image, const Target &target,
+                        const MachinePeaks &peaks) {
+    const PipelineRegistry &registry = PipelineRegistry::instance();
+    // The last pipeline of a chain schedules the whole chain.
+    std::string scheduledType = args.pipelineType.substr(args.pipelineType.rfind('+') + 1);
+
+    std::vector<std::string> schedules = registry.find(scheduledType).scheduleVariants;
+    // A schedule file is compared to the built-in variants.
+    if (!args.scheduleFile.empty()) {
+        schedules.push_back(args.scheduleFile);
+    }
+
+    std::vector<ScheduleTiming> timings;
+    // The schedules share the cost model of the pipeline.
+    PipelineCost cost{};
+    for (const std::string &schedule: schedules) {
+        std::cout << "Benchmarking the " << schedule << " schedule..." << std::endl;
+        bool isFile = schedule == args.scheduleFile;
+        auto pipeline = registry.create(args.pipelineType, image.type(), args.pipelineParameters,
+                                        isFile ? "" : schedule);
+        installHandlers(pipeline);
+        if (isFile) {
+            ScheduleFile(schedule).apply(*pipeline);
+        } else {
+            pipeline->scheduleForCPU();
+        }
+        pipeline->result.compile_jit(target);
+        cost = costOf(pipeline, image);
+
+        auto outputBuffer = Buffer<>(pipeline->result.output_type(), image.width(), image.height());
+        pipeline->input.set(image);
+        auto rep = [&pipeline, &outputBuffer, &target] {
+            WorkStealingPool::Context context(WorkStealingPool::current());
+            pipeline->result.realize(context.get(), outputBuffer, target);
+        };
+        // Warm-up before measuring
+        rep();
+        PerfCounts counts;
+        double executionTime;
+        if (args.perfCounters) {
+            executionTime = measureWithCounters(rep, args.reps, counts);
+        } else {
+            executionTime = measureExecutionTime([&rep, &args] {
+                for (int i = 0; i < args.reps; i++) {
+                    rep();
+                }
+            });
+        }
+        timings.push_back({schedule, executionTime / args.reps, counts});
+    }
+    printScheduleTable(timings);
+    printRooflineTable(timings, cost, peaks);
+}
+
+void benchmarkCallOverhead(const Arguments &args, const Buffer<> &image, const Target &target) {
+    auto pipeline = createPipeline(args, image.type());
+    schedulePipeline(pipeline, target, args.scheduleFile);
+    pipeline->result.compile_jit(target);
+    Callable callable = pipeline->compileToCallable(target);
+
+    // Small images, for which the cost of a call is not negligible
+    // compared to the computation itself.
+    std::vector<CallOverheadTiming> timings;
+    for (int size: {16, 64, 256}) {
+        if (size > image.width() || size > image.height()) {
+            break;
+        }
+        std::cout << "Benchmarking " << size << "x" << size << " images..." << std::endl;
+        Buffer<> tile = image.cropped(0, 0, size).cropped(1, 0, size);
+        auto outputBuffer = Buffer<>(pipeline->result.output_type(), size, size);
+        pipeline->input.set(tile);
+
+        // Both calls pay for setting up a context, as any call on the pool does.
+        auto realize = [&pipeline, &outputBuffer, &target] {
+            WorkStealingPool::Context context(WorkStealingPool::current());
+            pipeline->result.realize(context.get(), outputBuffer, target);
+        };
+        auto call = [&callable, &tile, &outputBuffer] {
+            WorkStealingPool::Context context(WorkStealingPool::current());
+            checkCall(callable(context.get(), tile, outputBuffer));
+        };
+        // Warm-up before measuring
+        realize();
+        call();
+
+        double realizeTime = measureExecutionTime([&realize, &args] {
+            for (int i = 0; i < args.reps; i++) {
+                realize();
+            }
+        });
+        double callableTime = measureExecutionTime([&call, &args] {
+            for (int i = 0; i < args.reps; i++) {
+                call();
+            }
+        });
+        timings.push_back({size, realizeTime / args.reps, callableTime / args.reps});
+    }
+    printCallOverheadTable(timings);
+}
+
+void benchmarkPagePolicies(const Arguments &args, const Buffer<> &image, const Target &target) {
+    auto pipeline = createPipeline(args, image.type());
+    // The intermediates follow whichever policy is set when the pipeline runs.
+    installPagePolicy(pipeline->result.jit_handlers());
+    schedulePipeline(pipeline, target, args.scheduleFile);
+    Callable callable = pipeline->compileToCallable(target);
+    Type outputType = pipeline->result.output_type();
+
+    std::vector<PagePolicyTiming> timings;
+    for (HugePages hugePages: {HugePages::None, HugePages::Transparent, HugePages::Reserved}) {
+        for (bool prefault: {false, true}) {
+            PagePolicy policy{hugePages, prefault};
+            std::cout << "Benchmarking " << describePagePolicy(policy) << " pages..." << std::endl;
+            setPagePolicy(policy);
+            uint64_t hugetlbFallbacks = countHugetlbFallbacks();
+
+            Buffer<> input, outputBuffer;
+            double allocationTime = measureExecutionTime([&input, &outputBuffer, &image, &outputType] {
+                input = copyBuffer(image);
+                outputBuffer = allocateBuffer(outputType, {image.width(), image.height()});
+            });
+            auto call = [&callable, &input, &outputBuffer] {
+                WorkStealingPool::Context context(WorkStealingPool::current());
+                checkCall(callable(context.get(), input, outputBuffer));
+            };
+            uint64_t pageFaults = countPageFaults();
+            double warmupTime = measureExecutionTime(call);
+            pageFaults = countPageFaults() - pageFaults;
+
+            // Opened after the warm-up, once the worker threads exist.
+            PerfCounters counters({PerfEvent::DataTlbMisses});
+            counters.start();
+            double executionTime = measureExecutionTime([&call, &args] {
+                for (int i = 0; i < args.reps; i++) {
+                    call();
+                }
+            });
+            PerfCounts counts = counters.stop();
+            int64_t tlbMisses = counts.count(PerfEvent::DataTlbMisses) > 0
+                                ? (int64_t) (counts[PerfEvent::DataTlbMisses] / args.reps) : -1;
+
+            timings.push_back({describePagePolicy(policy), allocationTime, warmupTime, pageFaults,
+                               executionTime / args.reps, tlbMisses, countHugetlbFallbacks() - hugetlbFallbacks});
+        }
+    }
+    setPagePolicy(args.pagePolicy);
+    printPagePolicyTable(timings);
+}
+
+void benchmarkThreadScaling(const Arguments &args, const Buffer<> &image, const Target &target) {
+    // The Halide runtime reads HL_NUM_THREADS only once, so the thread
+    // counts are set by running the pipeline on pools of that many workers.
+    auto pipeline = createPipeline(args, image.type());
+    schedulePipeline(pipeline, target, args.scheduleFile);
+    Callable callable = pipeline->compileToCallable(target);
+    auto outputBuffer = allocateBuffer(pipeline->result.output_type(), {image.width(), image.height()});
+
+    // Every count up to 16 cores, then every fourth one
+    int cores = (int) std::max(1u, std::thread::hardware_concurrency());
+    std::vector<int> threadCounts;
+    for (int threads = 1; threads <= cores; threads += threads < 16 ? 1 : 4) {
+        threadCounts.push_back(threads);
+    }
+    if (threadCounts.back() != cores) {
+        threadCounts.push_back(cores);
+    }
+
+    std::vector<ScalingTiming> timings;
+    for (int threads: threadCounts) {
+        std::cout << "Benchmarking " << threads << " thread(s)..." << std::endl;
+        // Workers pinned to the first cores; the pipeline runs on one of them.
+        WorkStealingPool pool(threads);
+        double executionTime = 0;
+        pool.runOnWorker([&pool, &callable, &image, &outputBuffer, &args, &executionTime] {
+            auto call = [&pool, &callable, &image, &outputBuffer] {
+                WorkStealingPool::Context context(&pool);
+                checkCall(callable(context.get(), image, outputBuffer));
+            };
+            // Warm-up before measuring
+            call();
+            executionTime = measureExecutionTime([&call, &args] {
+                for (int i = 0; i < args.reps; i++) {
+                    call();
+                }
+            });
+        });
+        timings.push_back({threads, executionTime / args.reps, measureMemoryBandwidth(pool)});
+    }
+    printScalingReport(timings);
+}
+
 void printPipelineSchedule(const std::shared_ptr<HalidePipeline> &pipeline) {
     printf("\nPseudo-code for the schedule:\n");
     pipeline->result.print_loop_nest();
@@ -220,6 +1100,34 @@ double measureExecutionTime(Func &&func) {
     return elapsed_seconds.count();
 }
 
+/**
+ * Times each of the reps on its own, with the hardware counters enabled
+ * around it only, so that reading them is not timed. Returns the total
+ * time and sets the counts to the means per rep.
+ */
+template<typename Func>
+double measureWithCounters(Func &&func, int reps, PerfCounts &counts) {
+    // Opened after the warm-up, once the worker threads exist.
+    PerfCounters counters(PerfCounters::allEvents());
+    double executionTime = 0;
+    PerfCounts total;
+    for (int i = 0; i < reps; i++) {
+        counters.start();
+        executionTime += measureExecutionTime(func);
+        accumulate(total, counters.stop());
+    }
+    counts.clear();
+    for (const auto &entry: total) {
+        counts[entry.first] = entry.second / reps;
+    }
+    return executionTime;
+}
+
+void printFirstRun(double firstRunTime, uint64_t pageFaults, double steadyStateTime) {
+    std::cout << "First run: " << firstRunTime * 1000 << " ms (" << pageFaults << " page faults), "
+              << firstRunTime / steadyStateTime << "x the steady state" << std::endl;
+}
+
 void printCurrentTime() {
     // Capture the current time point
     auto currentTimePoint = std::chrono::high_resolution_clock::now();
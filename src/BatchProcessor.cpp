@@ -0,0 +1,267 @@
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <filesystem>
+#include <iostream>
+#include <set>
+#include <thread>
+#include <utility>
+#include "BatchProcessor.h"
+#include "BoundedQueue.h"
+#include "pages.h"
+#include "Tracer.h"
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+struct BatchItem {
+    std::string imagePath;
+    std::string outputPath;
+    Clock::time_point startTime;
+    Buffer<> input;
+    Buffer<> output;
+};
+
+// Calls the function when the scope is left, whether normally or by an exception.
+template<typename Function>
+class ScopeExit {
+private:
+    Function function;
+
+public:
+    explicit ScopeExit(Function function) : function(std::move(function)) {}
+
+    ~ScopeExit() {
+        function();
+    }
+
+    ScopeExit(const ScopeExit &) = delete;
+
+    ScopeExit &operator=(const ScopeExit &) = delete;
+};
+
+}
+
+BatchProcessor::BatchProcessor(std::shared_ptr<HalidePipeline> pipeline, const Target &target,
+                               BatchOptions options, std::function<Buffer<>(const std::string &)> loadImage)
+        : pipeline(std::move(pipeline)), target(target), options(std::move(options)),
+          loadImage(std::move(loadImage)) {
+}
+
+std::vector<std::string> BatchProcessor::outputPathsFor(const std::vector<std::string> &imagePaths) const {
+    // Decided up front, as the encode threads would otherwise race to
+    // write the outputs of, e.g., a/frame.jpg and b/frame.png.
+    std::vector<std::string> outputPaths;
+    std::set<std::string> fileNames;
+    for (const std::string &imagePath: imagePaths) {
+        std::string stem = std::filesystem::path(imagePath).stem().string();
+        std::string fileName = stem + options.outputExtension;
+        for (int suffix = 2; !fileNames.insert(fileName).second; suffix++) {
+            fileName = stem + "-" + std::to_string(suffix) + options.outputExtension;
+        }
+        if (fileName != stem + options.outputExtension && options.saveOutputs) {
+            std::cerr << "Warning: the output of " << imagePath << " is saved as " << fileName
+                      << ", as another input has the same name." << std::endl;
+        }
+        outputPaths.push_back((std::filesystem::path(options.outputDirectory) / fileName).string());
+    }
+    return outputPaths;
+}
+
+BatchReport BatchProcessor::run(const std::vector<std::string> &imagePaths) {
+    // Compiled up front, so that compilation does not count towards the
+    // first image's latency. Unlike Func::realize(), the Callable takes the
+    // buffers as arguments, so that the compute threads can share it.
+    Callable callable;
+    {
+        Tracer::Span span("pipeline", "compile");
+        callable = pipeline->compileToCallable(target);
+    }
+    Type outputType = pipeline->result.output_type();
+
+    std::filesystem::create_directories(options.outputDirectory);
+    const std::vector<std::string> outputPaths = outputPathsFor(imagePaths);
+    Clock::time_point batchStartTime = Clock::now();
+
+    BoundedQueue<BatchItem> decoded(options.queueDepth);
+    BoundedQueue<BatchItem> computed(options.queueDepth);
+
+    std::atomic<size_t> nextImage{0};
+    std::atomic<int> activeComputeThreads{options.computeThreads};
+    BatchReport report;
+    std::mutex reportMutex;
+
+    auto decode = [&](size_t index, BatchItem &item) {
+        item.imagePath = imagePaths[index];
+        item.outputPath = outputPaths[index];
+        item.startTime = Clock::now();
+        Tracer::Span span("io", "decode", item.imagePath);
+        try {
+            item.input = loadImage(item.imagePath);
+            return true;
+        } catch (std::exception &e) {
+            std::cerr << e.what() << std::endl;
+            return false;
+        }
+    };
+    auto encode = [&](const BatchItem &item) {
+        try {
+            if (options.saveOutputs) {
+                Tracer::Span span("io", "encode", item.imagePath);
+                saveImageToFile(item.output, item.outputPath, options.pngOptions);
+            }
+            std::chrono::duration<double> latency = Clock::now() - item.startTime;
+
+            std::lock_guard<std::mutex> lock(reportMutex);
+            report.processedImages++;
+            report.processedPixels += (uint64_t) item.output.width() * item.output.height();
+            report.latencies.push_back(latency.count());
+        } catch (std::exception &e) {
+            std::cerr << item.imagePath << ": " << e.what() << std::endl;
+        }
+    };
+
+    // With a shared pool, each image is decoded and encoded by a task of the
+    // pool. At most queueDepth images are being decoded or wait in the queue,
+    // so that the decode tasks never block the workers.
+    WorkStealingPool *pool = options.ioPool;
+    std::atomic<int> decodesInFlight{0};
+    std::atomic<int> encodesInFlight{0};
+    std::function<void()> decodeNext = [&] {
+        for (size_t index = nextImage++; index < imagePaths.size(); index = nextImage++) {
+            BatchItem item;
+            if (decode(index, item)) {
+                decoded.push(std::move(item));
+                break;
+            }
+        }
+        // Once the images have run out, the compute stage starts no more tasks,
+        // so the last task to finish closes the queue, whether it pushed an image or not.
+        if (--decodesInFlight == 0 && nextImage >= imagePaths.size()) {
+            decoded.close();
+        }
+    };
+
+    std::vector<std::thread> decoders;
+    std::vector<std::thread> computeThreads;
+    std::vector<std::thread> encoders;
+    // The stages refer to this stack frame. Should run() be left early, e.g., by compute()
+    // throwing on this thread, they are stopped and waited for before it goes away.
+    ScopeExit stopStages([&] {
+        decoded.close();
+        computed.close();
+        for (std::vector<std::thread> *threads: {&decoders, &computeThreads, &encoders}) {
+            for (std::thread &thread: *threads) {
+                if (thread.joinable()) {
+                    thread.join();
+                }
+            }
+        }
+        if (pool) {
+            pool->helpUntil([&encodesInFlight, &decodesInFlight] {
+                return encodesInFlight == 0 && decodesInFlight == 0;
+            });
+        }
+    });
+
+    std::atomic<int> activeDecoders{options.decodeThreads};
+    if (pool) {
+        decodesInFlight = options.queueDepth;
+        for (int i = 0; i < options.queueDepth; i++) {
+            pool->submit(decodeNext);
+        }
+    } else {
+        for (int i = 0; i < options.decodeThreads; i++) {
+            decoders.emplace_back([&] {
+                for (size_t index = nextImage++; index < imagePaths.size(); index = nextImage++) {
+                    BatchItem item;
+                    if (decode(index, item) && !decoded.push(std::move(item))) {
+                        // The compute stage gave up.
+                        break;
+                    }
+                }
+                // The last decoder to finish tells the compute stage there is nothing more.
+                if (--activeDecoders == 0) {
+                    decoded.close();
+                }
+            });
+        }
+    }
+
+    auto compute = [&] {
+        // Each image has its own input and output buffers.
+        while (auto item = decoded.pop()) {
+            // Once the images have run out, the queue may be closed: no task is started then.
+            if (pool && nextImage < imagePaths.size()) {
+                decodesInFlight++;
+                pool->submit(decodeNext);
+            }
+            const Buffer<> &image = item->input;
+            try {
+                Tracer::Span span("pipeline", "realize", item->imagePath);
+                item->output = allocateBuffer(outputType, {image.width(), image.height()});
+                WorkStealingPool::Context context(WorkStealingPool::current());
+                checkCall(callable(context.get(), image, item->output));
+                if (target.has_gpu_feature()) {
+                    Tracer::Span copySpan("copy", "copy to host");
+                    item->output.copy_to_host();
+                }
+            } catch (std::exception &e) {
+                std::cerr << item->imagePath << ": " << e.what() << std::endl;
+                continue;
+            }
+            // Release the input as soon as possible; the queue holds the output only.
+            item->input = Buffer<>();
+            if (pool) {
+                // Helps with the pool's tasks while too many images wait for encoding.
+                pool->helpUntil([&] { return encodesInFlight < options.queueDepth; });
+                encodesInFlight++;
+                auto encoded = std::make_shared<BatchItem>(std::move(*item));
+                pool->submit([&encode, &encodesInFlight, encoded] {
+                    encode(*encoded);
+                    encodesInFlight--;
+                });
+            } else {
+                computed.push(std::move(*item));
+            }
+        }
+        // The last compute thread to finish tells the encoders there is nothing more.
+        if (--activeComputeThreads == 0) {
+            computed.close();
+        }
+    };
+    for (int i = 1; i < options.computeThreads; i++) {
+        computeThreads.emplace_back(compute);
+    }
+
+    for (int i = 0; i < options.encodeThreads && !pool; i++) {
+        encoders.emplace_back([&] {
+            while (auto item = computed.pop()) {
+                encode(*item);
+            }
+        });
+    }
+
+    compute();
+    for (auto &thread: computeThreads) {
+        thread.join();
+    }
+    for (auto &decoder: decoders) {
+        decoder.join();
+    }
+    for (auto &encoder: encoders) {
+        encoder.join();
+    }
+    if (pool) {
+        // The tasks refer to this stack frame, so all must be done before returning,
+        // including decode tasks started just as the images ran out.
+        pool->helpUntil([&encodesInFlight, &decodesInFlight] {
+            return encodesInFlight == 0 && decodesInFlight == 0;
+        });
+    }
+
+    std::chrono::duration<double> elapsedTime = Clock::now() - batchStartTime;
+    report.elapsedTime = elapsedTime.count();
+    return report;
+}
@@ -0,0 +1,89 @@
+#include "BufferArena.h"
+#include "pages.h"
+
+namespace {
+
+std::atomic<BufferArena *> currentArena{nullptr};
+
+// Rounds up to a quarter of the highest power of two below, so that at most 25% is wasted.
+size_t sizeClass(size_t size) {
+    size_t step = 1024;
+    while (step * 8 <= size) {
+        step *= 2;
+    }
+    return (size + step - 1) / step * step;
+}
+
+}
+
+BufferArena::BufferArena(size_t maxRetainedBytes) : maxRetainedBytes(maxRetainedBytes) {
+    currentArena = this;
+}
+
+BufferArena::~BufferArena() {
+    BufferArena *self = this;
+    currentArena.compare_exchange_strong(self, nullptr);
+    for (auto &entry: freeBlocks) {
+        for (void *block: entry.second) {
+            freePages(block);
+        }
+    }
+}
+
+BufferArena *BufferArena::current() {
+    return currentArena;
+}
+
+void BufferArena::install(JITHandlers &handlers) {
+    handlers.custom_malloc = allocate;
+    handlers.custom_free = release;
+}
+
+ArenaStatistics BufferArena::statistics() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    ArenaStatistics statistics = counters;
+    statistics.retainedBytes = retainedBytes;
+    return statistics;
+}
+
+void *BufferArena::allocate(JITUserContext *context, size_t size) {
+    BufferArena *arena = current();
+    size_t classSize = sizeClass(size);
+    if (arena != nullptr) {
+        std::lock_guard<std::mutex> lock(arena->mutex);
+        auto blocks = arena->freeBlocks.find(classSize);
+        if (blocks != arena->freeBlocks.end() && !blocks->second.empty()) {
+            void *block = blocks->second.back();
+            blocks->second.pop_back();
+            arena->retainedBytes -= classSize;
+            arena->counters.reusedBlocks++;
+            arena->counters.reusedBytes += size;
+            return block;
+        }
+    }
+
+    void *block = allocatePages(classSize);
+    if (block != nullptr && arena != nullptr) {
+        std::lock_guard<std::mutex> lock(arena->mutex);
+        arena->counters.freshBlocks++;
+        arena->counters.freshBytes += size;
+    }
+    return block;
+}
+
+void BufferArena::release(JITUserContext *context, void *block) {
+    if (block == nullptr) {
+        return;
+    }
+    size_t classSize = allocatedSize(block);
+    // Blocks freed after the arena are simply freed.
+    if (BufferArena *arena = current()) {
+        std::lock_guard<std::mutex> lock(arena->mutex);
+        if (arena->retainedBytes + classSize <= arena->maxRetainedBytes) {
+            arena->freeBlocks[classSize].push_back(block);
+            arena->retainedBytes += classSize;
+            return;
+        }
+    }
+    freePages(block);
+}
@@ -0,0 +1,83 @@
+#include <algorithm>
+#include <filesystem>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+#include "DebugDump.h"
+#include "rawimage.h"
+
+DebugDump::DebugDump(unsigned artifacts, const std::string &directory, const std::vector<std::string> &stageNames)
+        : artifacts(artifacts), directory(directory), stageNames(stageNames) {
+    // Asking for a stage implies dumping intermediates.
+    if (!stageNames.empty()) {
+        this->artifacts |= Intermediates;
+    }
+    if (this->artifacts & (Input | Intermediates)) {
+        std::filesystem::create_directories(directory);
+    }
+}
+
+unsigned DebugDump::parseArtifacts(const std::string &policy) {
+    unsigned artifacts = None;
+    std::stringstream stream(policy);
+    std::string name;
+    while (std::getline(stream, name, ',')) {
+        if (name == "none") {
+            continue;
+        } else if (name == "input") {
+            artifacts |= Input;
+        } else if (name == "intermediates") {
+            artifacts |= Intermediates;
+        } else if (name == "output") {
+            artifacts |= Output;
+        } else if (name == "all") {
+            artifacts |= All;
+        } else {
+            throw std::invalid_argument("Unknown artifact: " + name);
+        }
+    }
+    return artifacts;
+}
+
+bool DebugDump::isEnabled(Artifact artifact) const {
+    return (artifacts & artifact) != 0;
+}
+
+bool DebugDump::isStageSelected(const std::string &stageName) const {
+    return stageNames.empty() || std::find(stageNames.begin(), stageNames.end(), stageName) != stageNames.end();
+}
+
+void DebugDump::dumpInput(const Buffer<> &image) const {
+    saveImageToFile(image, (std::filesystem::path(directory) / "input.png").string());
+}
+
+void DebugDump::checkStages(HalidePipeline &pipeline) const {
+    std::vector<std::string> known;
+    for (Func &stage: pipeline.stages()) {
+        known.push_back(stage.name());
+    }
+    for (const std::string &stageName: stageNames) {
+        if (std::find(known.begin(), known.end(), stageName) == known.end()) {
+            std::string message = "Unknown stage: " + stageName + " (the pipeline's stages:";
+            for (const std::string &name: known) {
+                message += " " + name;
+            }
+            throw std::invalid_argument(message + ")");
+        }
+    }
+}
+
+void DebugDump::dumpStages(HalidePipeline &pipeline, const Buffer<> &image, const Target &target) const {
+    pipeline.input.set(image);
+    for (Func &stage: pipeline.stages()) {
+        if (!isStageSelected(stage.name())) {
+            continue;
+        }
+        std::cout << "Dumping stage " << stage.name() << "..." << std::endl;
+        // Unscheduled, every stage would recompute all those it calls, inlined.
+        stage.compute_root().parallel(stage.args()[1]);
+        Buffer<> values = stage.realize({image.width(), image.height()}, target);
+        values.copy_to_host();
+        saveRawImage(values, (std::filesystem::path(directory) / (stage.name() + rawImageExtension)).string());
+    }
+}
@@ -0,0 +1,145 @@
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+#include <unistd.h>
+#include "DecodedImageCache.h"
+#include "rawimage.h"
+
+namespace fs = std::filesystem;
+
+namespace {
+
+std::atomic<uint64_t> nextTemporaryId{0};
+
+}
+
+DecodedImageCache::DecodedImageCache(const std::string &directory, uint64_t maxSizeBytes)
+        : directory(directory), maxSizeBytes(maxSizeBytes) {
+    fs::create_directories(this->directory);
+}
+
+Buffer<> DecodedImageCache::load(const std::string &filePath, bool alignRows) {
+    std::ifstream file(filePath, std::ios::binary);
+    if (!file) {
+        throw std::runtime_error("Error loading image " + filePath + ": cannot open file");
+    }
+    std::vector<uint8_t> encoded((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+
+    fs::path path = entryPath(hashContent(encoded.data(), encoded.size()), encoded.size(), alignRows);
+    std::error_code error;
+    if (fs::exists(path, error)) {
+        // The modification time tracks the last use of the entry.
+        fs::last_write_time(path, fs::file_time_type::clock::now(), error);
+        try {
+            return loadRawImage(path.string());
+        } catch (std::runtime_error &) {
+            // Evicted by another process since, or damaged: decoded and stored again below.
+        }
+    }
+
+    Buffer<> image = loadImageFromMemory(encoded.data(), encoded.size(), alignRows);
+    store(image, path);
+    evict();
+    return image;
+}
+
+fs::path DecodedImageCache::entryPath(uint64_t contentHash, uint64_t contentSize, bool alignRows) const {
+    // The size guards against files whose hashes collide.
+    char name[64];
+    snprintf(name, sizeof(name), "%016llx-%llu%s", (unsigned long long) contentHash,
+             (unsigned long long) contentSize, alignRows ? "-aligned" : "");
+    return directory / (std::string(name) + rawImageExtension);
+}
+
+void DecodedImageCache::store(const Buffer<> &image, const fs::path &path) const {
+    // Written under a temporary name first, so that concurrent readers
+    // never map a partially written entry. The name is unique to the call,
+    // as threads of this process may store the same entry at once too.
+    fs::path temporaryPath = path;
+    temporaryPath += ".tmp" + std::to_string(getpid()) + "-" +
+                     std::to_string(std::hash<std::thread::id>()(std::this_thread::get_id())) + "-" +
+                     std::to_string(nextTemporaryId++);
+    try {
+        saveRawImage(image, temporaryPath.string());
+        fs::rename(temporaryPath, path);
+    } catch (std::exception &e) {
+        // The cache is an optimization only; a failed write is not fatal.
+        std::cerr << "Warning: failed to cache decoded image: " << e.what() << std::endl;
+        std::error_code error;
+        fs::remove(temporaryPath, error);
+    }
+}
+
+void DecodedImageCache::evict() const {
+    struct Entry {
+        fs::path path;
+        uint64_t size;
+        fs::file_time_type lastUse;
+    };
+    std::vector<Entry> entries;
+    uint64_t totalSize = 0;
+    std::error_code error;
+    for (const auto &file: fs::directory_iterator(directory, error)) {
+        if (file.path().extension() != rawImageExtension) {
+            continue;
+        }
+        // Checked one by one, as a successful call clears the error of a failed one.
+        std::error_code sizeError;
+        std::error_code timeError;
+        Entry entry{file.path(), file.file_size(sizeError), file.last_write_time(timeError)};
+        if (sizeError || timeError) {
+            continue;
+        }
+        totalSize += entry.size;
+        entries.push_back(entry);
+    }
+    if (totalSize <= maxSizeBytes) {
+        return;
+    }
+
+    std::sort(entries.begin(), entries.end(), [](const Entry &lhs, const Entry &rhs) {
+        return lhs.lastUse < rhs.lastUse;
+    });
+    for (const auto &entry: entries) {
+        if (totalSize <= maxSizeBytes) {
+            break;
+        }
+        // Loaded images keep their mappings of the removed files.
+        if (fs::remove(entry.path, error)) {
+            totalSize -= entry.size;
+        }
+    }
+}
+
+uint64_t DecodedImageCache::hashContent(const uint8_t *data, size_t size) {
+    // Multiply-rotate hash over 64-bit words, finished with the
+    // splitmix64 mixer. Not cryptographic, but fast and well-distributed.
+    const uint64_t prime1 = 0x9E3779B185EBCA87ULL;
+    const uint64_t prime2 = 0xC2B2AE3D27D4EB4FULL;
+    uint64_t hash = prime1 ^ size;
+
+    size_t i = 0;
+    for (; i + sizeof(uint64_t) <= size; i += sizeof(uint64_t)) {
+        uint64_t word;
+        memcpy(&word, data + i, sizeof(word));
+        hash ^= word * prime2;
+        hash = ((hash << 31) | (hash >> 33)) * prime1;
+    }
+    uint64_t tail = 0;
+    memcpy(&tail, data + i, size - i);
+    hash ^= tail * prime2;
+
+    hash ^= hash >> 30;
+    hash *= 0xBF58476D1CE4E5B9ULL;
+    hash ^= hash >> 27;
+    hash *= 0x94D049BB133111EBULL;
+    hash ^= hash >> 31;
+    return hash;
+}
@@ -0,0 +1,101 @@
+#include <algorithm>
+#include <condition_variable>
+#include <cstring>
+#include <exception>
+#include <mutex>
+#include "NumaExecutor.h"
+#include "pages.h"
+#include "pipelines/HalidePipeline.h"
+
+NumaExecutor::NumaExecutor(const std::vector<NumaNode> &nodes) {
+    for (const NumaNode &node: nodes) {
+        Band band;
+        band.node = node;
+        band.pool = std::make_unique<WorkStealingPool>(node.cpus);
+        bands.push_back(std::move(band));
+    }
+}
+
+void NumaExecutor::forEachBand(const std::function<void(Band &)> &function) {
+    std::mutex mutex;
+    std::condition_variable finished;
+    size_t remaining = bands.size();
+    std::vector<std::exception_ptr> errors(bands.size());
+    for (size_t i = 0; i < bands.size(); i++) {
+        bands[i].pool->submit([&, i] {
+            try {
+                function(bands[i]);
+            } catch (...) {
+                errors[i] = std::current_exception();
+            }
+            std::lock_guard<std::mutex> lock(mutex);
+            if (--remaining == 0) {
+                finished.notify_one();
+            }
+        });
+    }
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        finished.wait(lock, [&remaining] { return remaining == 0; });
+    }
+    for (const std::exception_ptr &error: errors) {
+        if (error) {
+            std::rethrow_exception(error);
+        }
+    }
+}
+
+void NumaExecutor::distribute(const Buffer<> &image, int halo, const Type &outputType) {
+    int cpuCount = 0;
+    for (const Band &band: bands) {
+        cpuCount += (int) band.node.cpus.size();
+    }
+    const int imageTop = image.dim(1).min();
+    const int imageBottom = imageTop + image.height();
+    int cpusBefore = 0;
+    for (Band &band: bands) {
+        band.top = imageTop + (int) ((int64_t) image.height() * cpusBefore / cpuCount);
+        cpusBefore += (int) band.node.cpus.size();
+        band.height = imageTop + (int) ((int64_t) image.height() * cpusBefore / cpuCount) - band.top;
+    }
+
+    forEachBand([&image, halo, &outputType, imageTop, imageBottom](Band &band) {
+        if (band.height == 0) {
+            return;
+        }
+        // Beyond the edges of the image, the pipeline's boundary condition applies as usual.
+        int first = std::max(imageTop, band.top - halo);
+        int last = std::min(imageBottom, band.top + band.height + halo);
+        band.input = copyBuffer(image.cropped(1, first, last - first));
+
+        band.output = allocateBuffer(outputType, {image.width(), band.height});
+        band.output.set_min(image.dim(0).min(), band.top);
+        // Touched here rather than by the first run, so that the timing
+        // does not include placing the pages.
+        memset(band.output.data(), 0, band.output.size_in_bytes());
+    });
+}
+
+void NumaExecutor::run(Callable &callable) {
+    forEachBand([&callable](Band &band) {
+        if (band.height > 0) {
+            WorkStealingPool::Context context(band.pool.get());
+            checkCall(callable(context.get(), band.input, band.output));
+        }
+    });
+}
+
+void NumaExecutor::gather(Buffer<> &output) const {
+    for (const Band &band: bands) {
+        if (band.height > 0) {
+            output.copy_from(band.output);
+        }
+    }
+}
+
+void NumaExecutor::printBands(std::ostream &stream) const {
+    for (const Band &band: bands) {
+        stream << "Node " << band.node.id << " (" << band.pool->threadCount() << " workers): rows "
+               << band.top << "-" << band.top + band.height - 1 << std::endl;
+    }
+}
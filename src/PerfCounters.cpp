@@ -0,0 +1,153 @@
+#include <algorithm>
+#include <filesystem>
+#include "PerfCounters.h"
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+namespace {
+
+#ifdef __linux__
+perf_event_attr attributesOf(PerfEvent event) {
+    perf_event_attr attributes{};
+    attributes.size = sizeof(attributes);
+    attributes.disabled = 1;
+    attributes.exclude_kernel = 1;
+    attributes.exclude_hv = 1;
+    attributes.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+    switch (event) {
+        case PerfEvent::Cycles:
+            attributes.type = PERF_TYPE_HARDWARE;
+            attributes.config = PERF_COUNT_HW_CPU_CYCLES;
+            break;
+        case PerfEvent::Instructions:
+            attributes.type = PERF_TYPE_HARDWARE;
+            attributes.config = PERF_COUNT_HW_INSTRUCTIONS;
+            break;
+        case PerfEvent::L1DataMisses:
+            attributes.type = PERF_TYPE_HW_CACHE;
+            attributes.config = PERF_COUNT_HW_CACHE_L1D | (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+                                (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+            break;
+        case PerfEvent::LastLevelCacheMisses:
+            attributes.type = PERF_TYPE_HARDWARE;
+            attributes.config = PERF_COUNT_HW_CACHE_MISSES;
+            break;
+        case PerfEvent::DataTlbMisses:
+            attributes.type = PERF_TYPE_HW_CACHE;
+            attributes.config = PERF_COUNT_HW_CACHE_DTLB | (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+                                (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+            break;
+    }
+    return attributes;
+}
+
+std::vector<int> threadsOfProcess() {
+    std::vector<int> threads;
+    std::error_code error;
+    for (const auto &entry: std::filesystem::directory_iterator("/proc/self/task", error)) {
+        threads.push_back(std::stoi(entry.path().filename().string()));
+    }
+    return threads;
+}
+#endif
+
+}
+
+PerfCounters::PerfCounters(const std::vector<PerfEvent> &events) {
+#ifdef __linux__
+    std::vector<int> threads = threadsOfProcess();
+    for (PerfEvent event: events) {
+        perf_event_attr attributes = attributesOf(event);
+        Counter counter{event, {}};
+        for (int thread: threads) {
+            // Threads may have exited since they were listed.
+            int descriptor = (int) syscall(SYS_perf_event_open, &attributes, thread, -1, -1, 0);
+            if (descriptor >= 0) {
+                counter.descriptors.push_back(descriptor);
+            }
+        }
+        if (!counter.descriptors.empty()) {
+            counters.push_back(std::move(counter));
+        }
+    }
+#endif
+}
+
+PerfCounters::~PerfCounters() {
+#ifdef __linux__
+    for (const Counter &counter: counters) {
+        for (int descriptor: counter.descriptors) {
+            close(descriptor);
+        }
+    }
+#endif
+}
+
+bool PerfCounters::isCounting(PerfEvent event) const {
+    return std::any_of(counters.begin(), counters.end(), [event](const Counter &counter) {
+        return counter.event == event;
+    });
+}
+
+void PerfCounters::start() {
+#ifdef __linux__
+    for (const Counter &counter: counters) {
+        for (int descriptor: counter.descriptors) {
+            ioctl(descriptor, PERF_EVENT_IOC_RESET, 0);
+            ioctl(descriptor, PERF_EVENT_IOC_ENABLE, 0);
+        }
+    }
+#endif
+}
+
+PerfCounts PerfCounters::stop() {
+    PerfCounts counts;
+#ifdef __linux__
+    for (const Counter &counter: counters) {
+        for (int descriptor: counter.descriptors) {
+            ioctl(descriptor, PERF_EVENT_IOC_DISABLE, 0);
+        }
+    }
+    for (const Counter &counter: counters) {
+        double count = 0;
+        for (int descriptor: counter.descriptors) {
+            // The value, and the times the counter was enabled and running
+            uint64_t values[3];
+            if (read(descriptor, values, sizeof(values)) != sizeof(values)) {
+                continue;
+            }
+            if (values[2] > 0) {
+                count += (double) values[0] * values[1] / values[2];
+            }
+        }
+        counts[counter.event] = (uint64_t) count;
+    }
+#endif
+    return counts;
+}
+
+std::string PerfCounters::name(PerfEvent event) {
+    switch (event) {
+        case PerfEvent::Cycles:
+            return "cycles";
+        case PerfEvent::Instructions:
+            return "instructions";
+        case PerfEvent::L1DataMisses:
+            return "L1D load misses";
+        case PerfEvent::LastLevelCacheMisses:
+            return "LLC misses";
+        case PerfEvent::DataTlbMisses:
+            return "dTLB load misses";
+    }
+    return "";
+}
+
+std::vector<PerfEvent> PerfCounters::allEvents() {
+    return {PerfEvent::Cycles, PerfEvent::Instructions, PerfEvent::L1DataMisses,
+            PerfEvent::LastLevelCacheMisses, PerfEvent::DataTlbMisses};
+}
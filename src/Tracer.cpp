@@ -0,0 +1,170 @@
+#include <cstdio>
+#include <fstream>
+#include <stdexcept>
+#include "Tracer.h"
+
+namespace {
+
+std::atomic<Tracer *> currentTracer{nullptr};
+
+std::atomic<int> nextThread{1};
+
+// Small, stable thread ids, numbered in the order the threads first record a span
+int currentThread() {
+    thread_local int thread = nextThread++;
+    return thread;
+}
+
+std::string escapeJson(const std::string &text) {
+    std::string escaped;
+    for (char c: text) {
+        if (c == '"' || c == '\\') {
+            escaped += '\\';
+            escaped += c;
+        } else if ((unsigned char) c < 0x20) {
+            char code[8];
+            snprintf(code, sizeof(code), "\\u%04x", c);
+            escaped += code;
+        } else {
+            escaped += c;
+        }
+    }
+    return escaped;
+}
+
+// The region of a produce, consume or realization, e.g., "[0, 256) x [0, 32)"
+std::string describeRegion(const halide_trace_event_t *event) {
+    std::string region;
+    for (int i = 0; i + 1 < event->dimensions; i += 2) {
+        int min = event->coordinates[i];
+        int extent = event->coordinates[i + 1];
+        region += (i > 0 ? " x [" : "[") + std::to_string(min) + ", " + std::to_string(min + extent) + ")";
+    }
+    return region;
+}
+
+}
+
+Tracer::Tracer() : origin(Clock::now()) {
+    currentTracer = this;
+}
+
+Tracer::~Tracer() {
+    Tracer *self = this;
+    currentTracer.compare_exchange_strong(self, nullptr);
+}
+
+Tracer *Tracer::current() {
+    return currentTracer;
+}
+
+double Tracer::now() const {
+    return std::chrono::duration<double, std::micro>(Clock::now() - origin).count();
+}
+
+size_t Tracer::eventCount() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return events.size();
+}
+
+Tracer::Span::Span(const std::string &category, const std::string &name, const std::string &detail)
+        : tracer(current()) {
+    if (tracer != nullptr) {
+        event = {name, category, currentThread(), tracer->now(), 0, detail};
+    }
+}
+
+Tracer::Span::~Span() {
+    if (tracer != nullptr) {
+        event.duration = tracer->now() - event.start;
+        std::lock_guard<std::mutex> lock(tracer->mutex);
+        tracer->events.push_back(std::move(event));
+    }
+}
+
+void Tracer::install(HalidePipeline &pipeline) {
+    // Funcs are handles: tracing the copies traces the pipeline.
+    for (auto &entry: pipeline.funcs()) {
+        entry.second.trace_realizations();
+    }
+    pipeline.result.jit_handlers().custom_trace = trace;
+}
+
+int32_t Tracer::trace(JITUserContext *context, const halide_trace_event_t *event) {
+    Tracer *tracer = current();
+    if (tracer == nullptr) {
+        return 0;
+    }
+    const char *category;
+    switch (event->event) {
+        case halide_trace_begin_realization:
+        case halide_trace_end_realization:
+            category = "realization";
+            break;
+        case halide_trace_produce:
+        case halide_trace_end_produce:
+            category = "produce";
+            break;
+        case halide_trace_consume:
+        case halide_trace_end_consume:
+            category = "consume";
+            break;
+        case halide_trace_begin_pipeline:
+        case halide_trace_end_pipeline:
+            category = "pipeline";
+            break;
+        default:
+            // Loads, stores and tags are not spans.
+            return 0;
+    }
+
+    double time = tracer->now();
+    switch (event->event) {
+        case halide_trace_begin_realization:
+        case halide_trace_produce:
+        case halide_trace_consume:
+        case halide_trace_begin_pipeline: {
+            // The end event refers to its begin event by the id returned here.
+            int32_t id = tracer->nextSpanId++;
+            Event span{event->func, category, currentThread(), time, 0, describeRegion(event)};
+            std::lock_guard<std::mutex> lock(tracer->mutex);
+            tracer->openSpans.emplace(id, std::move(span));
+            return id;
+        }
+        default: {
+            std::lock_guard<std::mutex> lock(tracer->mutex);
+            auto span = tracer->openSpans.find(event->parent_id);
+            if (span != tracer->openSpans.end()) {
+                span->second.duration = time - span->second.start;
+                tracer->events.push_back(std::move(span->second));
+                tracer->openSpans.erase(span);
+            }
+            return 0;
+        }
+    }
+}
+
+void Tracer::write(const std::string &path) const {
+    std::ofstream file(path);
+    if (!file) {
+        throw std::runtime_error("Failed to write the trace: " + path);
+    }
+    std::lock_guard<std::mutex> lock(mutex);
+    file << "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n";
+    file << R"({"name": "process_name", "ph": "M", "pid": 1, "args": {"name": "halide_experiments"}})";
+    char times[64];
+    for (const Event &event: events) {
+        // Microseconds with nanosecond precision
+        snprintf(times, sizeof(times), "\"ts\": %.3f, \"dur\": %.3f", event.start, event.duration);
+        file << ",\n{\"name\": \"" << escapeJson(event.name) << "\", \"cat\": \"" << escapeJson(event.category)
+             << "\", \"ph\": \"X\", " << times << ", \"pid\": 1, \"tid\": " << event.thread;
+        if (!event.detail.empty()) {
+            file << ", \"args\": {\"detail\": \"" << escapeJson(event.detail) << "\"}";
+        }
+        file << "}";
+    }
+    file << "\n]}\n";
+    if (!file) {
+        throw std::runtime_error("Failed to write the trace: " + path);
+    }
+}
@@ -0,0 +1,318 @@
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <exception>
+#include <iostream>
+#include <string>
+#include "numa.h"
+#include "WorkStealingPool.h"
+
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+namespace {
+
+std::atomic<WorkStealingPool *> currentPool{nullptr};
+
+// Set on the pool's workers
+thread_local WorkStealingPool *workerPool = nullptr;
+thread_local int workerIndex = -1;
+
+// Returns 0, or the error number if the thread could not be pinned.
+int pinToCore(std::thread &thread, int core) {
+#ifdef __linux__
+    if (core >= CPU_SETSIZE) {
+        return EINVAL;
+    }
+    cpu_set_t cpus;
+    CPU_ZERO(&cpus);
+    CPU_SET(core, &cpus);
+    return pthread_setaffinity_np(thread.native_handle(), sizeof(cpus), &cpus);
+#else
+    return 0;
+#endif
+}
+
+// Worker i on the i-th allowed CPU (modulo their number), or -1 for unpinned workers
+std::vector<int> coresFor(int threadCount, bool pinWorkers) {
+    std::vector<int> cpus = allowedCpus();
+    if (threadCount <= 0) {
+        threadCount = (int) cpus.size();
+    }
+    std::vector<int> workerCores;
+    for (int i = 0; i < threadCount; i++) {
+        workerCores.push_back(pinWorkers ? cpus[i % cpus.size()] : -1);
+    }
+    return workerCores;
+}
+
+}
+
+WorkStealingPool::WorkStealingPool(int threadCount, bool pinWorkers)
+        : WorkStealingPool(coresFor(threadCount, pinWorkers)) {
+    currentPool = this;
+}
+
+WorkStealingPool::WorkStealingPool(const std::vector<int> &cores) {
+    auto threadCount = (int) std::max<size_t>(cores.size(), 1);
+    for (int i = 0; i < threadCount; i++) {
+        workers.push_back(std::make_unique<Worker>());
+    }
+    // Started once all the deques exist, as the workers steal from each other.
+    int unpinnedCount = 0;
+    std::string firstFailure;
+    for (int i = 0; i < threadCount; i++) {
+        workers[i]->thread = std::thread(&WorkStealingPool::work, this, i);
+        if (i < (int) cores.size() && cores[i] >= 0) {
+            if (int error = pinToCore(workers[i]->thread, cores[i])) {
+                if (unpinnedCount++ == 0) {
+                    firstFailure = "CPU " + std::to_string(cores[i]) + ": " + strerror(error);
+                }
+            }
+        }
+    }
+    if (unpinnedCount > 0) {
+        std::cerr << "Warning: " << unpinnedCount << " of " << threadCount << " workers could not be pinned ("
+                  << firstFailure << ") and run unpinned." << std::endl;
+    }
+}
+
+WorkStealingPool::~WorkStealingPool() {
+    WorkStealingPool *self = this;
+    currentPool.compare_exchange_strong(self, nullptr);
+    {
+        std::lock_guard<std::mutex> lock(sleepMutex);
+        isStopping = true;
+    }
+    wakeUp.notify_all();
+    for (auto &worker: workers) {
+        worker->thread.join();
+    }
+}
+
+WorkStealingPool::Context::Context(WorkStealingPool *pool) : pool(pool) {
+    if (pool != nullptr) {
+        handlers.custom_do_par_for = doParFor;
+        handlers.custom_do_task = doTask;
+    }
+}
+
+WorkStealingPool *WorkStealingPool::current() {
+    // Loops nested in a task stay on the pool running it.
+    if (workerPool != nullptr) {
+        return workerPool;
+    }
+    return currentPool;
+}
+
+int WorkStealingPool::currentWorker() const {
+    return workerPool == this ? workerIndex : -1;
+}
+
+void WorkStealingPool::submit(Task task) {
+    int index = currentWorker();
+    if (index < 0) {
+        index = (int) (nextWorker++ % workers.size());
+    }
+    {
+        std::lock_guard<std::mutex> lock(workers[index]->mutex);
+        workers[index]->tasks.push_back(std::move(task));
+    }
+    pendingTasks++;
+    // Taking the lock orders the increment before a sleeping worker's check.
+    {
+        std::lock_guard<std::mutex> lock(sleepMutex);
+    }
+    wakeUp.notify_one();
+    wakeHelpers();
+}
+
+void WorkStealingPool::wakeHelpers() {
+    // A helper counts itself in before checking isDone() under the lock: either it sees
+    // the changes made before this call, or it is waiting by the time the lock is taken.
+    if (sleepingHelpers > 0) {
+        {
+            std::lock_guard<std::mutex> lock(sleepMutex);
+        }
+        helperWakeUp.notify_all();
+    }
+}
+
+bool WorkStealingPool::runTask(int index) {
+    Task task;
+    if (index >= 0) {
+        // The newest task of its own, whose data is likely still in the cache
+        std::lock_guard<std::mutex> lock(workers[index]->mutex);
+        if (!workers[index]->tasks.empty()) {
+            task = std::move(workers[index]->tasks.back());
+            workers[index]->tasks.pop_back();
+        }
+    }
+    // Otherwise, the oldest task of another worker
+    auto count = (int) workers.size();
+    int first = index >= 0 ? index + 1 : (int) (nextWorker % workers.size());
+    for (int i = 0; i < count && !task; i++) {
+        Worker &victim = *workers[(first + i) % count];
+        std::lock_guard<std::mutex> lock(victim.mutex);
+        if (!victim.tasks.empty()) {
+            task = std::move(victim.tasks.front());
+            victim.tasks.pop_front();
+        }
+    }
+    if (!task) {
+        return false;
+    }
+    pendingTasks--;
+    task();
+    wakeHelpers();
+    return true;
+}
+
+void WorkStealingPool::work(int index) {
+    workerPool = this;
+    workerIndex = index;
+    while (true) {
+        if (runTask(index)) {
+            continue;
+        }
+        std::unique_lock<std::mutex> lock(sleepMutex);
+        wakeUp.wait(lock, [this] { return pendingTasks > 0 || isStopping; });
+        if (isStopping && pendingTasks == 0) {
+            return;
+        }
+    }
+}
+
+void WorkStealingPool::helpUntil(const std::function<bool()> &isDone) {
+    // The last chunks of a loop finish within microseconds, which is not worth sleeping for.
+    const int spinRounds = 64;
+    int index = currentWorker();
+    int idleRounds = 0;
+    while (!isDone()) {
+        if (runTask(index)) {
+            idleRounds = 0;
+        } else if (idleRounds++ < spinRounds) {
+            std::this_thread::yield();
+        } else {
+            sleepingHelpers++;
+            {
+                std::unique_lock<std::mutex> lock(sleepMutex);
+                helperWakeUp.wait(lock, [this, &isDone] { return pendingTasks > 0 || isDone(); });
+            }
+            sleepingHelpers--;
+            idleRounds = 0;
+        }
+    }
+}
+
+int WorkStealingPool::parallelFor(int min, int size, const std::function<int(int)> &body) {
+    if (size <= 0) {
+        return 0;
+    }
+    if (!isMonitoring) {
+        return runLoop(min, size, body);
+    }
+    using Clock = std::chrono::steady_clock;
+    LoopLoad load;
+    load.busyTimes.assign(workers.size() + 1, 0);
+    std::mutex loadMutex;
+    auto timedBody = [this, &body, &load, &loadMutex](int i) {
+        auto start = Clock::now();
+        int error = body(i);
+        double time = std::chrono::duration<double>(Clock::now() - start).count();
+        int slot = currentWorker();
+        std::lock_guard<std::mutex> lock(loadMutex);
+        load.busyTimes[slot >= 0 ? slot : workers.size()] += time;
+        load.taskTimes.push_back(time);
+        return error;
+    };
+    auto start = Clock::now();
+    int result = runLoop(min, size, timedBody);
+    load.wallTime = std::chrono::duration<double>(Clock::now() - start).count();
+
+    std::lock_guard<std::mutex> lock(monitorMutex);
+    monitoredLoops.push_back(std::move(load));
+    return result;
+}
+
+void WorkStealingPool::startMonitoring() {
+    std::lock_guard<std::mutex> lock(monitorMutex);
+    monitoredLoops.clear();
+    isMonitoring = true;
+}
+
+std::vector<LoopLoad> WorkStealingPool::stopMonitoring() {
+    isMonitoring = false;
+    std::lock_guard<std::mutex> lock(monitorMutex);
+    std::vector<LoopLoad> loops;
+    loops.swap(monitoredLoops);
+    return loops;
+}
+
+int WorkStealingPool::runLoop(int min, int size, const std::function<int(int)> &body) {
+    // A few chunks per thread, so that the threads finishing early find work to steal.
+    int chunkCount = std::min(size, 4 * (threadCount() + 1));
+    std::atomic<int> remainingChunks{chunkCount};
+    std::atomic<int> result{0};
+    auto runChunk = [&body, &remainingChunks, &result, min, size, chunkCount](int chunk) {
+        int begin = min + (int) ((int64_t) size * chunk / chunkCount);
+        int end = min + (int) ((int64_t) size * (chunk + 1) / chunkCount);
+        for (int i = begin; i < end && result == 0; i++) {
+            int error = body(i);
+            if (error != 0) {
+                int noError = 0;
+                result.compare_exchange_strong(noError, error);
+            }
+        }
+        remainingChunks--;
+    };
+
+    for (int chunk = 1; chunk < chunkCount; chunk++) {
+        submit([&runChunk, chunk] { runChunk(chunk); });
+    }
+    runChunk(0);
+    helpUntil([&remainingChunks] { return remainingChunks == 0; });
+    return result;
+}
+
+void WorkStealingPool::runOnWorker(const std::function<void()> &function) {
+    std::mutex mutex;
+    std::condition_variable finished;
+    bool isFinished = false;
+    std::exception_ptr error;
+    submit([&] {
+        try {
+            function();
+        } catch (...) {
+            error = std::current_exception();
+        }
+        std::lock_guard<std::mutex> lock(mutex);
+        isFinished = true;
+        finished.notify_one();
+    });
+    {
+        // Not helping: the calling thread is not one of the pool's.
+        std::unique_lock<std::mutex> lock(mutex);
+        finished.wait(lock, [&isFinished] { return isFinished; });
+    }
+    if (error) {
+        std::rethrow_exception(error);
+    }
+}
+
+int WorkStealingPool::doTask(JITUserContext *context, int (*task)(JITUserContext *, int, uint8_t *),
+                             int index, uint8_t *closure) {
+    return task(context, index, closure);
+}
+
+int WorkStealingPool::doParFor(JITUserContext *context, int (*task)(JITUserContext *, int, uint8_t *),
+                               int min, int size, uint8_t *closure) {
+    // Installed by contexts with a pool only
+    WorkStealingPool *pool = static_cast<Context *>(context)->pool;
+    return pool->parallelFor(min, size, [context, task, closure](int i) {
+        return doTask(context, task, i, closure);
+    });
+}
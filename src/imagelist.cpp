@@ -0,0 +1,90 @@
+#include <algorithm>
+#include <cctype>
+#include <filesystem>
+#include <fstream>
+#include <stdexcept>
+#include <glob.h>
+#include "imagelist.h"
+#include "rawimage.h"
+
+namespace fs = std::filesystem;
+
+namespace {
+
+bool isGlobPattern(const std::string &path) {
+    return path.find_first_of("*?[") != std::string::npos;
+}
+
+bool hasImageExtension(const fs::path &path) {
+    static const std::vector<std::string> extensions = {
+            ".jpg", ".jpeg", ".png", ".bmp", ".tga", ".gif", ".psd", ".pgm", ".ppm", ".pnm", ".hdr",
+            rawImageExtension
+    };
+    std::string extension = path.extension().string();
+    std::transform(extension.begin(), extension.end(), extension.begin(), ::tolower);
+    return std::find(extensions.begin(), extensions.end(), extension) != extensions.end();
+}
+
+void appendDirectory(const std::string &directory, std::vector<std::string> &imagePaths) {
+    std::vector<std::string> files;
+    for (const auto &entry: fs::directory_iterator(directory)) {
+        if (entry.is_regular_file() && hasImageExtension(entry.path())) {
+            files.push_back(entry.path().string());
+        }
+    }
+    std::sort(files.begin(), files.end());
+    imagePaths.insert(imagePaths.end(), files.begin(), files.end());
+}
+
+void appendGlob(const std::string &pattern, std::vector<std::string> &imagePaths) {
+    glob_t matches{};
+    // glob() sorts the matches.
+    if (glob(pattern.c_str(), 0, nullptr, &matches) == 0) {
+        for (size_t i = 0; i < matches.gl_pathc; i++) {
+            imagePaths.emplace_back(matches.gl_pathv[i]);
+        }
+    }
+    globfree(&matches);
+}
+
+void appendFileList(const std::string &listPath, std::vector<std::string> &imagePaths) {
+    std::ifstream list(listPath);
+    if (!list) {
+        throw std::runtime_error("Cannot read the image list " + listPath);
+    }
+    std::string line;
+    while (std::getline(list, line)) {
+        line.erase(std::find(line.begin(), line.end(), '#'), line.end());
+        auto notSpace = [](unsigned char c) { return !std::isspace(c); };
+        line.erase(line.begin(), std::find_if(line.begin(), line.end(), notSpace));
+        line.erase(std::find_if(line.rbegin(), line.rend(), notSpace).base(), line.end());
+        if (!line.empty()) {
+            imagePaths.push_back(line);
+        }
+    }
+}
+
+}
+
+bool isImageCollection(const std::string &pathOrPattern) {
+    return pathOrPattern.rfind('@', 0) == 0 || isGlobPattern(pathOrPattern) || fs::is_directory(pathOrPattern);
+}
+
+std::vector<std::string> expandImagePaths(const std::vector<std::string> &pathsOrPatterns) {
+    std::vector<std::string> imagePaths;
+    for (const auto &pathOrPattern: pathsOrPatterns) {
+        if (pathOrPattern.rfind('@', 0) == 0) {
+            appendFileList(pathOrPattern.substr(1), imagePaths);
+        } else if (isGlobPattern(pathOrPattern)) {
+            appendGlob(pathOrPattern, imagePaths);
+        } else if (fs::is_directory(pathOrPattern)) {
+            appendDirectory(pathOrPattern, imagePaths);
+        } else {
+            imagePaths.push_back(pathOrPattern);
+        }
+    }
+    if (imagePaths.empty()) {
+        throw std::runtime_error("No images found in the given directories, patterns or file lists");
+    }
+    return imagePaths;
+}
@@ -1,8 +1,21 @@
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <cstring>
+#include <memory>
+#include <mutex>
 #include <random>
+#include <stdexcept>
 #include <utility>
+#include <vector>
 #include "Halide.h"
 #include "../lib/stb/stb_image.h"
 #include "../lib/stb/stb_image_write.h"
+#include "imaging.h"
+#include "pages.h"
+#include "pngwriter.h"
+#include "rawimage.h"
 
 using namespace Halide;
 
@@ -29,37 +42,261 @@ Buffer<uint8_t> createNoisyImage(int size, float gaussianNoiseSigma) {
     return buffer;
 }
 
-Buffer<uint8_t> loadImageFromFile(const std::string &filePath) {
+namespace {
+
+int roundUp(int value, int multiple) {
+    return (value + multiple - 1) / multiple * multiple;
+}
+
+// The shape of interleaved pixels, with the row stride in elements. Returns the number of dimensions.
+int interleavedShape(int width, int height, int channels, int rowStride, halide_dimension_t *shape) {
+    if (channels > 1) {
+        shape[0] = {0, width, channels};
+        shape[1] = {0, height, rowStride};
+        shape[2] = {0, channels, 1};
+        return 3;
+    }
+    shape[0] = {0, width, 1};
+    shape[1] = {0, height, rowStride};
+    return 2;
+}
+
+// Whether the rows of the image can be handed to the writers as they are.
+bool hasInterleavedRows(const Buffer<> &image) {
+    if (image.dimensions() > 2) {
+        return image.dim(0).stride() == image.channels() && image.dim(2).stride() == 1;
+    }
+    return image.dim(0).stride() == 1;
+}
+
+const uint8_t *rowAddress(const Buffer<> &image, int row) {
+    return (const uint8_t *) image.data() + (size_t) row * image.dim(1).stride() * image.type().bytes();
+}
+
+// Copies the pixels returned by stb_image into a buffer owning its memory, and releases them.
+Buffer<> copyDecodedPixels(void *data, Type type, int width, int height, int channels, bool alignRows) {
+    std::unique_ptr<void, void (*)(void *)> decoded(data, stbi_image_free);
+    halide_dimension_t shape[3];
+    int dimensions = interleavedShape(width, height, channels, width * channels, shape);
+    Buffer<> pixels(type, data, dimensions, shape);
+    if (alignRows) {
+        // Rows padded to the alignment, so that aligned vector
+        // loads are possible at the start of every row.
+        shape[1].stride = roundUp(width * channels * type.bytes(), imageRowAlignment) / type.bytes();
+    }
+    Buffer<> image = allocateBuffer(type, dimensions, shape);
+    image.copy_from(pixels);
+    // Signal for the GPU that the buffer's changed.
+    image.set_host_dirty();
+    return image;
+}
+
+}
+
+Buffer<> loadImageFromFile(const std::string &filePath, bool alignRows) {
+    if (isRawImagePath(filePath)) {
+        // Raw images are mapped with the layout they were saved with.
+        return loadRawImage(filePath);
+    }
     int width;
     int height;
     int channels;
-    unsigned char *data = stbi_load(filePath.c_str(), &width, &height, &channels, 0);
+    void *data;
+    Type type;
+    // Keep the precision of the file: 16-bit PNGs and HDR images are not reduced to 8 bits.
+    if (stbi_is_hdr(filePath.c_str())) {
+        data = stbi_loadf(filePath.c_str(), &width, &height, &channels, 0);
+        type = Float(32);
+    } else if (stbi_is_16_bit(filePath.c_str())) {
+        data = stbi_load_16(filePath.c_str(), &width, &height, &channels, 0);
+        type = UInt(16);
+    } else {
+        data = stbi_load(filePath.c_str(), &width, &height, &channels, 0);
+        type = UInt(8);
+    }
     if (!data) {
-        // Handle the error (e.g., print an error message)
-        std::cerr << "Error loading image: " << stbi_failure_reason() << std::endl;
-        // TODO: raise exception
+        throw std::runtime_error("Error loading image " + filePath + ": " + stbi_failure_reason());
     }
-    // TODO: free memory
-    // stbi_image_free(data);
-    Buffer<uint8_t> buffer;
-    if (channels > 1) {
-        buffer = Buffer<uint8_t>::make_interleaved(data, width, height, channels);
+    return copyDecodedPixels(data, type, width, height, channels, alignRows);
+}
+
+Buffer<> loadImageFromMemory(const uint8_t *encoded, size_t size, bool alignRows) {
+    int width;
+    int height;
+    int channels;
+    void *data;
+    Type type;
+    if (stbi_is_hdr_from_memory(encoded, (int) size)) {
+        data = stbi_loadf_from_memory(encoded, (int) size, &width, &height, &channels, 0);
+        type = Float(32);
+    } else if (stbi_is_16_bit_from_memory(encoded, (int) size)) {
+        data = stbi_load_16_from_memory(encoded, (int) size, &width, &height, &channels, 0);
+        type = UInt(16);
     } else {
-        buffer = Buffer<uint8_t>(data, width, height);
+        data = stbi_load_from_memory(encoded, (int) size, &width, &height, &channels, 0);
+        type = UInt(8);
     }
-    // Signal for the GPU that the buffer's changed.
-    buffer.set_host_dirty();
-    return buffer;
+    if (!data) {
+        throw std::runtime_error(std::string("Error decoding image: ") + stbi_failure_reason());
+    }
+    return copyDecodedPixels(data, type, width, height, channels, alignRows);
+}
+
+Type probePixelType(const std::string &filePath) {
+    if (isRawImagePath(filePath)) {
+        return probeRawPixelType(filePath);
+    } else if (stbi_is_hdr(filePath.c_str())) {
+        return Float(32);
+    } else if (stbi_is_16_bit(filePath.c_str())) {
+        return UInt(16);
+    }
+    return UInt(8);
+}
+
+ImageFormat imageFormatFromPath(const std::string &filePath) {
+    std::string extension = std::filesystem::path(filePath).extension().string();
+    std::transform(extension.begin(), extension.end(), extension.begin(), ::tolower);
+    if (extension == rawImageExtension) {
+        return ImageFormat::RawContainer;
+    } else if (extension == ".raw") {
+        return ImageFormat::Raw;
+    } else if (extension == ".pgm") {
+        return ImageFormat::Pgm;
+    } else if (extension == ".ppm") {
+        return ImageFormat::Ppm;
+    }
+    return ImageFormat::Png;
+}
+
+namespace {
+
+bool writePng(const Buffer<> &image, const std::string &targetFilePath, const PngOptions &pngOptions) {
+#ifdef HALIDE_EXPERIMENTS_WITH_ZLIB
+    // Also for a single thread: unlike stb_image_write, it keeps no options in globals.
+    return writePngParallel(image, targetFilePath, pngOptions);
+#else
+    if (image.type() != UInt(8)) {
+        std::cerr << "Error: 16-bit PNGs require zlib; use .pgm/.ppm, .raw or " << rawImageExtension
+                  << " instead." << std::endl;
+        return false;
+    }
+    // stb_image_write reads its options from globals, which are set once,
+    // before any other thread can be writing a PNG.
+    static std::once_flag optionsSet;
+    std::call_once(optionsSet, [&pngOptions] {
+        stbi_write_png_compression_level = pngOptions.compressionLevel;
+        stbi_write_force_png_filter = pngOptions.filter;
+    });
+    return stbi_write_png(targetFilePath.c_str(), image.width(), image.height(), image.channels(),
+                          image.data(), image.dim(1).stride()) != 0;
+#endif
+}
+
+// Writes the rows one after another, without padding. Netpbm stores
+// 16-bit samples in big-endian order, raw files in the native one.
+bool writeRows(const Buffer<> &image, FILE *file, bool isBigEndian) {
+    size_t rowSize = (size_t) image.width() * image.channels() * image.type().bytes();
+    std::vector<uint8_t> swapped;
+    for (int row = 0; row < image.height(); row++) {
+        const uint8_t *rowData = rowAddress(image, row);
+        if (isBigEndian && image.type().bytes() == 2) {
+            swapped.assign(rowData, rowData + rowSize);
+            for (size_t i = 0; i < rowSize; i += 2) {
+                std::swap(swapped[i], swapped[i + 1]);
+            }
+            rowData = swapped.data();
+        }
+        if (fwrite(rowData, 1, rowSize, file) != rowSize) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Binary PGM (P5) or PPM (P6).
+bool writeNetpbm(const Buffer<> &image, const std::string &targetFilePath, int expectedChannels) {
+    if (image.channels() != expectedChannels) {
+        std::cerr << "Error: " << targetFilePath << " requires " << expectedChannels
+                  << " channel(s), the image has " << image.channels() << "." << std::endl;
+        return false;
+    }
+    FILE *file = fopen(targetFilePath.c_str(), "wb");
+    if (!file) {
+        return false;
+    }
+    int maxValue = image.type() == UInt(16) ? 65535 : 255;
+    bool isWritten = fprintf(file, "P%d\n%d %d\n%d\n", expectedChannels == 1 ? 5 : 6,
+                             image.width(), image.height(), maxValue) > 0 &&
+                     writeRows(image, file, true);
+    return fclose(file) == 0 && isWritten;
 }
 
-void saveImageToFile(Buffer<uint8_t> image, const std::string &targetFilePath) {
-//    int numElements = image.width() * image.height() * image.channels();
-//    auto *inputData = new uint8_t[numElements];
-//    memcpy(inputData, image.data(), numElements);
-    int result = stbi_write_png(targetFilePath.c_str(), image.width(), image.height(), image.channels(),
-                                image.data(), image.width() * image.channels());
-    if (result == 0) {
+bool writeRaw(const Buffer<> &image, const std::string &targetFilePath) {
+    FILE *file = fopen(targetFilePath.c_str(), "wb");
+    if (!file) {
+        return false;
+    }
+    bool isWritten = writeRows(image, file, false);
+    return fclose(file) == 0 && isWritten;
+}
+
+Buffer<> makeInterleaved(Type type, int width, int height, int channels, int dimensions) {
+    return dimensions > 2 ? Buffer<>::make_interleaved(type, width, height, channels)
+                          : Buffer<>(type, width, height);
+}
+
+// Maps floats in [0, 1] to the full 16-bit range, for formats without float samples.
+Buffer<> quantizeToUInt16(const Buffer<> &image) {
+    Buffer<> quantized = makeInterleaved(UInt(16), image.width(), image.height(), image.channels(),
+                                         image.dimensions());
+    size_t rowSamples = (size_t) image.width() * image.channels();
+    for (int row = 0; row < image.height(); row++) {
+        auto *source = (const float *) rowAddress(image, row);
+        auto *target = (uint16_t *) rowAddress(quantized, row);
+        for (size_t i = 0; i < rowSamples; i++) {
+            target[i] = (uint16_t) (std::clamp(source[i], 0.0f, 1.0f) * 65535 + 0.5f);
+        }
+    }
+    return quantized;
+}
+
+}
+
+void saveImageToFile(Buffer<> image, const std::string &targetFilePath, const PngOptions &pngOptions) {
+    ImageFormat format = imageFormatFromPath(targetFilePath);
+    if (format == ImageFormat::RawContainer) {
+        saveRawImage(image, targetFilePath);
+        return;
+    }
+    if (!hasInterleavedRows(image)) {
+        Buffer<> interleaved = makeInterleaved(image.type(), image.width(), image.height(), image.channels(),
+                                               image.dimensions());
+        interleaved.set_min(image.dim(0).min(), image.dim(1).min());
+        interleaved.copy_from(image);
+        image = interleaved;
+    }
+    if (image.type().is_float() && format != ImageFormat::Raw) {
+        image = quantizeToUInt16(image);
+    }
+
+    bool isSaved = false;
+    switch (format) {
+        case ImageFormat::Png:
+            isSaved = writePng(image, targetFilePath, pngOptions);
+            break;
+        case ImageFormat::Pgm:
+            isSaved = writeNetpbm(image, targetFilePath, 1);
+            break;
+        case ImageFormat::Ppm:
+            isSaved = writeNetpbm(image, targetFilePath, 3);
+            break;
+        case ImageFormat::Raw:
+            isSaved = writeRaw(image, targetFilePath);
+            break;
+        case ImageFormat::RawContainer:
+            break;
+    }
+    if (!isSaved) {
         std::cerr << "Error: Failed to save image to file." << std::endl;
     }
-//    delete[] inputData;
-}
\ No newline at end of file
+}
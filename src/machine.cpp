@@ -0,0 +1,81 @@
+#include <algorithm>
+#include <chrono>
+#include <vector>
+#include "machine.h"
+
+double measureMemoryBandwidth(WorkStealingPool &pool, size_t arrayBytes) {
+    const size_t length = arrayBytes / sizeof(double);
+    const int chunkCount = 256;
+    // Not initialized here: the workers touch the pages first, as the pipelines would.
+    std::unique_ptr<double[]> a(new double[length]), b(new double[length]), c(new double[length]);
+    auto forEachChunk = [&pool, length, chunkCount](const std::function<void(size_t, size_t)> &body) {
+        pool.runOnWorker([&] {
+            pool.parallelFor(0, chunkCount, [&body, length, chunkCount](int chunk) {
+                body(length * chunk / chunkCount, length * (chunk + 1) / chunkCount);
+                return 0;
+            });
+        });
+    };
+
+    forEachChunk([&a, &b, &c](size_t begin, size_t end) {
+        std::fill(a.get() + begin, a.get() + end, 0.0);
+        std::fill(b.get() + begin, b.get() + end, 1.0);
+        std::fill(c.get() + begin, c.get() + end, 2.0);
+    });
+    double bestTime = 0;
+    for (int run = 0; run < 5; run++) {
+        auto start = std::chrono::steady_clock::now();
+        forEachChunk([&a, &b, &c](size_t begin, size_t end) {
+            const double scalar = 3.0;
+            for (size_t i = begin; i < end; i++) {
+                a[i] = b[i] + scalar * c[i];
+            }
+        });
+        double time = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        bestTime = run == 0 ? time : std::min(bestTime, time);
+    }
+    return 3.0 * (double) (length * sizeof(double)) / bestTime;
+}
+
+double measurePeakOperationRate(WorkStealingPool &pool, const Target &target) {
+    const int chainLength = 256;
+    Var x("x"), y("y");
+    Func peak("peak");
+    Expr value = cast<float>(x + y);
+    for (int i = 0; i < chainLength; i++) {
+        value = value * 0.999f + 0.001f;
+    }
+    peak(x, y) = value;
+    // Eight vectors at a time, so that the chains hide the latency of the FMA units.
+    const int vectorSize = target.natural_vector_size<float>() * 8;
+    peak.vectorize(x, vectorSize).parallel(y);
+    peak.compile_jit(target);
+
+    Buffer<float> output(vectorSize * 16, 4096);
+    double bestTime = 0;
+    pool.runOnWorker([&pool, &peak, &output, &bestTime] {
+        WorkStealingPool::Context context(&pool);
+        // Warm-up before measuring
+        peak.realize(context.get(), output);
+        for (int run = 0; run < 5; run++) {
+            auto start = std::chrono::steady_clock::now();
+            peak.realize(context.get(), output);
+            double time = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+            bestTime = run == 0 ? time : std::min(bestTime, time);
+        }
+    });
+    return 2.0 * chainLength * output.width() * output.height() / bestTime;
+}
+
+MachinePeaks measureMachinePeaks(const Target &target) {
+    std::unique_ptr<WorkStealingPool> ownPool;
+    WorkStealingPool *pool = WorkStealingPool::current();
+    if (pool == nullptr) {
+        ownPool = std::make_unique<WorkStealingPool>();
+        pool = ownPool.get();
+    }
+    MachinePeaks peaks;
+    peaks.memoryBandwidth = measureMemoryBandwidth(*pool);
+    peaks.operationRate = measurePeakOperationRate(*pool, target);
+    return peaks;
+}
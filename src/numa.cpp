@@ -0,0 +1,99 @@
+#include <algorithm>
+#include <cctype>
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+#include <thread>
+#include "numa.h"
+
+#ifdef __linux__
+#include <sched.h>
+#include <unistd.h>
+#endif
+
+namespace fs = std::filesystem;
+
+std::vector<int> parseCpuList(const std::string &list) {
+    std::vector<int> cpus;
+    std::istringstream ranges(list);
+    for (std::string range; std::getline(ranges, range, ',');) {
+        range.erase(std::remove_if(range.begin(), range.end(), ::isspace), range.end());
+        if (range.empty()) {
+            continue;
+        }
+        try {
+            size_t dash = range.find('-');
+            int first = std::stoi(range.substr(0, dash));
+            int last = dash == std::string::npos ? first : std::stoi(range.substr(dash + 1));
+            if (first < 0 || last < first) {
+                throw std::invalid_argument(range);
+            }
+            for (int cpu = first; cpu <= last; cpu++) {
+                cpus.push_back(cpu);
+            }
+        } catch (const std::logic_error &) {
+            throw std::invalid_argument("Invalid CPU list: " + list);
+        }
+    }
+    return cpus;
+}
+
+std::vector<int> allowedCpus() {
+    std::vector<int> cpus;
+#ifdef __linux__
+    // The main thread's affinity, which is the process's: the workers pinned since do not count.
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    if (sched_getaffinity(getpid(), sizeof(set), &set) == 0) {
+        for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+            if (CPU_ISSET(cpu, &set)) {
+                cpus.push_back(cpu);
+            }
+        }
+    }
+#endif
+    if (cpus.empty()) {
+        unsigned cores = std::max(1u, std::thread::hardware_concurrency());
+        for (unsigned cpu = 0; cpu < cores; cpu++) {
+            cpus.push_back((int) cpu);
+        }
+    }
+    return cpus;
+}
+
+std::vector<NumaNode> detectNumaNodes() {
+    const std::vector<int> allowed = allowedCpus();
+    std::vector<NumaNode> nodes;
+    const fs::path nodeDirectory = "/sys/devices/system/node";
+    std::error_code error;
+    for (const auto &entry: fs::directory_iterator(nodeDirectory, error)) {
+        std::string name = entry.path().filename().string();
+        if (name.rfind("node", 0) != 0 || name.size() == 4 ||
+            !std::all_of(name.begin() + 4, name.end(), ::isdigit)) {
+            continue;
+        }
+        std::ifstream file(entry.path() / "cpulist");
+        std::string list;
+        if (!std::getline(file, list)) {
+            continue;
+        }
+        NumaNode node{std::stoi(name.substr(4)), parseCpuList(list)};
+        // Workers could not be pinned to the others.
+        node.cpus.erase(std::remove_if(node.cpus.begin(), node.cpus.end(), [&allowed](int cpu) {
+            return !std::binary_search(allowed.begin(), allowed.end(), cpu);
+        }), node.cpus.end());
+        // Memory-only nodes, and those the process may not run on, have no CPUs to run a band on.
+        if (!node.cpus.empty()) {
+            nodes.push_back(std::move(node));
+        }
+    }
+    std::sort(nodes.begin(), nodes.end(), [](const NumaNode &a, const NumaNode &b) {
+        return a.id < b.id;
+    });
+
+    if (nodes.empty()) {
+        nodes.push_back({0, allowed});
+    }
+    return nodes;
+}
@@ -0,0 +1,185 @@
+#include <atomic>
+#include <cstdint>
+#include <cstdlib>
+#include <stdexcept>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include "pages.h"
+
+namespace {
+
+PagePolicy currentPolicy;
+
+std::atomic<uint64_t> hugetlbFallbacks{0};
+
+// Precedes each block; also keeps the blocks aligned as Halide's own allocations are.
+constexpr size_t headerSize = 128;
+constexpr size_t pageSize = 4096;
+constexpr size_t hugePageSize = 2 << 20;
+// Smaller blocks are not worth a mapping of their own.
+constexpr size_t minMappedSize = 1 << 20;
+
+struct BlockHeader {
+    size_t size;
+    // 0 for blocks from malloc
+    size_t mappedSize;
+    void *mapping;
+};
+
+size_t roundUp(size_t size, size_t alignment) {
+    return (size + alignment - 1) / alignment * alignment;
+}
+
+// Maps a 2 MB-aligned region, trimming the excess on both ends.
+void *mapAlignedToHugePages(size_t mappedSize) {
+    void *mapping = mmap(nullptr, mappedSize + hugePageSize, PROT_READ | PROT_WRITE,
+                         MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (mapping == MAP_FAILED) {
+        return nullptr;
+    }
+    auto *start = static_cast<char *>(mapping);
+    size_t head = (hugePageSize - reinterpret_cast<uintptr_t>(start) % hugePageSize) % hugePageSize;
+    if (head > 0) {
+        munmap(start, head);
+    }
+    munmap(start + head + mappedSize, hugePageSize - head);
+    start += head;
+#ifdef MADV_HUGEPAGE
+    madvise(start, mappedSize, MADV_HUGEPAGE);
+#endif
+    return start;
+}
+
+void *mapPages(size_t &mappedSize, HugePages hugePages) {
+    if (hugePages == HugePages::None) {
+        mappedSize = roundUp(mappedSize, pageSize);
+        void *mapping = mmap(nullptr, mappedSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        return mapping == MAP_FAILED ? nullptr : mapping;
+    }
+    mappedSize = roundUp(mappedSize, hugePageSize);
+#ifdef MAP_HUGETLB
+    if (hugePages == HugePages::Reserved) {
+        void *mapping = mmap(nullptr, mappedSize, PROT_READ | PROT_WRITE,
+                             MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        if (mapping != MAP_FAILED) {
+            return mapping;
+        }
+    }
+#endif
+    if (hugePages == HugePages::Reserved) {
+        hugetlbFallbacks++;
+    }
+    return mapAlignedToHugePages(mappedSize);
+}
+
+}
+
+HugePages parseHugePages(const std::string &name) {
+    if (name == "none") {
+        return HugePages::None;
+    } else if (name == "thp") {
+        return HugePages::Transparent;
+    } else if (name == "hugetlb") {
+        return HugePages::Reserved;
+    }
+    throw std::invalid_argument("Unknown huge pages: " + name + " (expected none, thp or hugetlb)");
+}
+
+std::string describePagePolicy(const PagePolicy &policy) {
+    std::string description = policy.hugePages == HugePages::Transparent ? "thp"
+                            : policy.hugePages == HugePages::Reserved ? "hugetlb" : "none";
+    return policy.prefault ? description + "+prefault" : description;
+}
+
+void setPagePolicy(const PagePolicy &policy) {
+    currentPolicy = policy;
+}
+
+PagePolicy pagePolicy() {
+    return currentPolicy;
+}
+
+void *allocatePages(size_t size) {
+    const PagePolicy policy = currentPolicy;
+    size_t mappedSize = size + headerSize;
+    char *start;
+    if (mappedSize < minMappedSize) {
+        start = static_cast<char *>(std::aligned_alloc(headerSize, roundUp(mappedSize, headerSize)));
+        mappedSize = 0;
+    } else {
+        start = static_cast<char *>(mapPages(mappedSize, policy.hugePages));
+    }
+    if (start == nullptr) {
+        return nullptr;
+    }
+    if (policy.prefault) {
+        // One write per page faults it in; huge pages have been advised already.
+        size_t touchedSize = mappedSize > 0 ? mappedSize : size + headerSize;
+        for (size_t offset = 0; offset < touchedSize; offset += pageSize) {
+            start[offset] = 0;
+        }
+    }
+    *reinterpret_cast<BlockHeader *>(start) = {size, mappedSize, start};
+    return start + headerSize;
+}
+
+void freePages(void *block) {
+    if (block == nullptr) {
+        return;
+    }
+    const BlockHeader &header = *reinterpret_cast<BlockHeader *>(static_cast<char *>(block) - headerSize);
+    if (header.mappedSize == 0) {
+        std::free(header.mapping);
+    } else {
+        munmap(header.mapping, header.mappedSize);
+    }
+}
+
+size_t allocatedSize(const void *block) {
+    return reinterpret_cast<const BlockHeader *>(static_cast<const char *>(block) - headerSize)->size;
+}
+
+Buffer<> allocateBuffer(const Type &type, const std::vector<int> &sizes) {
+    if (currentPolicy.isDefault()) {
+        return Buffer<>(type, sizes);
+    }
+    Buffer<> buffer(type, nullptr, sizes);
+    buffer.allocate(allocatePages, freePages);
+    return buffer;
+}
+
+Buffer<> allocateBuffer(const Type &type, int dimensions, const halide_dimension_t *shape) {
+    Buffer<> buffer(type, nullptr, dimensions, shape);
+    if (currentPolicy.isDefault()) {
+        buffer.allocate();
+    } else {
+        buffer.allocate(allocatePages, freePages);
+    }
+    return buffer;
+}
+
+Buffer<> copyBuffer(const Buffer<> &buffer) {
+    if (currentPolicy.isDefault()) {
+        return buffer.copy();
+    }
+    return buffer.copy(allocatePages, freePages);
+}
+
+void installPagePolicy(JITHandlers &handlers) {
+    handlers.custom_malloc = [](JITUserContext *, size_t size) {
+        return allocatePages(size);
+    };
+    handlers.custom_free = [](JITUserContext *, void *block) {
+        freePages(block);
+    };
+}
+
+uint64_t countHugetlbFallbacks() {
+    return hugetlbFallbacks;
+}
+
+uint64_t countPageFaults() {
+    rusage usage{};
+    getrusage(RUSAGE_SELF, &usage);
+    return (uint64_t) usage.ru_minflt + usage.ru_majflt;
+}
@@ -1,25 +1,47 @@
 
 #include "pipelines/ColorToGrayConverter.h"
 #include "target.h"
+#include "pipelines/PipelineRegistry.h"
 
-ColorToGrayConverter::ColorToGrayConverter(const Buffer<uint8_t> &input)
-        : input(input),
+template<typename T>
+ColorToGrayConverter<T>::ColorToGrayConverter()
+        : HalidePipeline(ImageParam(type_of<T>(), 3, "input")),
           x("x"), y("y"), c("c") {
+    // Accept interleaved as well as planar images.
+    input.dim(0).set_stride(Expr());
     implement();
 }
 
-void ColorToGrayConverter::implement() {
-    result(x, y) = cast<uint8_t>(0.299f * input(x, y, 0) +
-                                 0.587f * input(x, y, 1) +
-                                 0.114f * input(x, y, 2));
+template<typename T>
+void ColorToGrayConverter<T>::implement() {
+    result(x, y) = cast<T>(0.299f * cast<float>(source(x, y, 0)) +
+                           0.587f * cast<float>(source(x, y, 1)) +
+                           0.114f * cast<float>(source(x, y, 2)));
 }
 
-void ColorToGrayConverter::scheduleForCPU() {
-    result.vectorize(x, 4)
-            .parallel(y);
+template<typename T>
+void ColorToGrayConverter<T>::scheduleForCPU() {
+    // The variants compared in the README.
+    if (scheduleVariant == "compute_root") {
+        result.compute_root();
+    } else if (scheduleVariant == "parallel") {
+        result.compute_root().parallel(y);
+    } else if (scheduleVariant == "vectorized") {
+        result.compute_root().vectorize(x, 4);
+    } else {
+        result.vectorize(x, 4)
+                .parallel(y);
+    }
+}
+
+template<typename T>
+double ColorToGrayConverter<T>::operationsPerPixel() const {
+    // A multiplication and two multiply-adds
+    return 5 + HalidePipeline::operationsPerPixel();
 }
 
-bool ColorToGrayConverter::scheduleForGPU() {
+template<typename T>
+bool ColorToGrayConverter<T>::scheduleForGPU() {
     Target target = find_gpu_target();
     if (!target.has_gpu_feature()) {
         return false;
@@ -32,4 +54,25 @@ bool ColorToGrayConverter::scheduleForGPU() {
     return true;
 }
 
+template class ColorToGrayConverter<uint8_t>;
+template class ColorToGrayConverter<uint16_t>;
+template class ColorToGrayConverter<float>;
 
+namespace {
+
+const PipelineRegistry::Registration registration({
+        "colortogray",
+        "Luma of a color image (ITU-R BT.601 weights)",
+        {},
+        3, 1,
+        {"default", "compute_root", "parallel", "vectorized"},
+        // No pipeline produces color images, so it always comes first in a chain.
+        [](const Type &pixelType, const PipelineParameters &, std::shared_ptr<HalidePipeline>) {
+            return dispatchPixelType(pixelType, [&](auto pixel) -> std::shared_ptr<HalidePipeline> {
+                using T = decltype(pixel);
+                return std::make_shared<ColorToGrayConverter<T>>();
+            });
+        }
+});
+
+}
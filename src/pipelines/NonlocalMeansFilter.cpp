@@ -2,11 +2,14 @@
 
 
 #include "pipelines/NonlocalMeansFilter.h"
+#include <stdexcept>
 #include "target.h"
+#include "pipelines/PipelineRegistry.h"
 
-NonlocalMeansFilter::NonlocalMeansFilter(
-        const Buffer<uint8_t> &input, int patchSize, int searchWindowSize) :
-        input(input), patchSize(patchSize), searchWindowSize(searchWindowSize),
+template<typename T>
+NonlocalMeansFilter<T>::NonlocalMeansFilter(int patchSize, int searchWindowSize, float h) :
+        HalidePipeline(ImageParam(type_of<T>(), 2, "input")),
+        patchSize(patchSize), searchWindowSize(searchWindowSize), h(h),
         x("x"), y("y"), a("a"), b("b"), i("i"), j("j"),
         clamped("clamped"),
         gaussian("gaussian"),
@@ -20,9 +23,38 @@ NonlocalMeansFilter::NonlocalMeansFilter(
     implement();
 }
 
-void NonlocalMeansFilter::implement() {
+template<typename T>
+NonlocalMeansFilter<T>::NonlocalMeansFilter(int patchSize, int searchWindowSize, float h,
+                                            std::shared_ptr<HalidePipeline> upstream) :
+        HalidePipeline(std::move(upstream)),
+        patchSize(patchSize), searchWindowSize(searchWindowSize), h(h),
+        x("x"), y("y"), a("a"), b("b"), i("i"), j("j"),
+        clamped("clamped"),
+        gaussian("gaussian"),
+        weightedPixelDist("weightedPixelDist"),
+        neighborhoodDifference("neighborhoodDifference"),
+        areDifferentPoints("areDifferentPoints"),
+        neighborhoodWeight("neighborhoodWeight"),
+        weightsSum("weightsSum"),
+        newPixelValues("newPixelValues"),
+        newPixelValuesNormalized("newPixelValuesNormalized") {
+    if (this->upstream->result.dimensions() != 2) {
+        throw std::invalid_argument("The non-local means filter requires a single-channel upstream pipeline");
+    }
+    implement();
+}
+
+template<typename T>
+void NonlocalMeansFilter<T>::implement() {
+    Expr maxValue = cast<float>(PixelTraits<T>::maxValue);
+
+    // The source may be a Func, which has no bounds of its own;
+    // a chain preserves the extent of its input image.
+    Region bounds = {{input.dim(0).min(), input.dim(0).extent()},
+                     {input.dim(1).min(), input.dim(1).extent()}};
+
     // Makes sure the image
-    clamped(x, y) = cast<float>(BoundaryConditions::repeat_edge(input)(x, y)) / 255;
+    clamped(x, y) = cast<float>(BoundaryConditions::repeat_edge(source, bounds)(x, y)) / maxValue;
 
     gaussian = createGaussian(patchSize, patchSize, weighingGaussianSigma);
 
@@ -61,10 +93,11 @@ void NonlocalMeansFilter::implement() {
     // Normalize by the total sum of weights
     newPixelValuesNormalized(x, y) = newPixelValues(x, y) / weightsSum(x, y);
 
-    result(x, y) = cast<uint8_t>(newPixelValuesNormalized(x, y) * 255);
+    result(x, y) = cast<T>(newPixelValuesNormalized(x, y) * maxValue);
 }
 
-Func NonlocalMeansFilter::createGaussian(int width, int height, float sigma) {
+template<typename T>
+Func NonlocalMeansFilter<T>::createGaussian(int width, int height, float sigma) {
     Var x("x"), y("y");
 
     Func gauss("gauss");
@@ -81,32 +114,141 @@ Func NonlocalMeansFilter::createGaussian(int width, int height, float sigma) {
     return normalized_gauss;
 }
 
+template<typename T>
+std::vector<Func> NonlocalMeansFilter<T>::stages() {
+    std::vector<Func> funcs;
+    if (upstream) {
+        funcs = upstream->stages();
+    }
+    funcs.insert(funcs.end(), {clamped, weightsSum, newPixelValues, newPixelValuesNormalized});
+    return funcs;
+}
+
+template<typename T>
+std::map<std::string, Func> NonlocalMeansFilter<T>::funcs() {
+    std::map<std::string, Func> funcs = HalidePipeline::funcs();
+    funcs.insert({
+            {"clamped", clamped},
+            {"gaussian", gaussian},
+            {"weightedPixelDist", weightedPixelDist},
+            {"neighborhoodDifference", neighborhoodDifference},
+            {"areDifferentPoints", areDifferentPoints},
+            {"neighborhoodWeight", neighborhoodWeight},
+            {"weightsSum", weightsSum},
+            {"newPixelValues", newPixelValues},
+            {"newPixelValuesNormalized", newPixelValuesNormalized},
+    });
+    return funcs;
+}
+
+template<typename T>
+int NonlocalMeansFilter<T>::halo() const {
+    // Patches are compared anywhere in the search window.
+    return searchWindowSize / 2 + patchSize / 2 + HalidePipeline::halo();
+}
 
-void NonlocalMeansFilter::scheduleForCPU() {
+template<typename T>
+double NonlocalMeansFilter<T>::operationsPerPixel() const {
+    // For each pixel of the search window: the patch distance (a difference,
+    // a square and a multiply-add per patch pixel), the weight (scaling,
+    // exponential and masking) and its accumulations (an add and a multiply-add).
+    double window = (double) searchWindowSize * searchWindowSize;
+    double patch = (double) patchSize * patchSize;
+    return window * (4 * patch + 6) + HalidePipeline::operationsPerPixel();
+}
+
+template<typename T>
+void NonlocalMeansFilter<T>::scheduleForCPU() {
     // The Gaussian can be precomputed entirely.
     // Otherwise, it will be recomputed for every patch
     // (with a quadratic complexity).
     gaussian.compute_root();
 
-    neighborhoodWeight.compute_root().compute_with(neighborhoodDifference, a);
+    if (scheduleVariant.empty() || scheduleVariant == "default") {
+        if (upstream) {
+            scheduleFusedForCPU();
+            return;
+        }
+        neighborhoodWeight.compute_root().compute_with(neighborhoodDifference, a);
+        result.compute_root();
+        return;
+    }
 
-//    Var x_outer, y_outer, x_inner, y_inner, tile_index;
-//    result.tile(x, y, x_outer, y_outer, x_inner, y_inner, 16, 16)
-//            .fuse(x_outer, y_outer, tile_index)
-//            .parallel(tile_index);
+    // The variants compared in the README.
+    if (scheduleVariant == "compute_root") {
+        result.compute_root();
+    } else if (scheduleVariant == "parallel") {
+        result.compute_root().parallel(y);
+    } else {
+        Var xo, yo, xi, yi, tileIndex;
+        result.tile(x, y, xo, yo, xi, yi, 4, 4)
+                .fuse(xo, yo, tileIndex)
+                .parallel(tileIndex);
 
+        Var xVector, yVector;
+        result.split(xi, xVector, xi, 4)
+                .split(yi, yVector, yi, 4)
+                .vectorize(xi)
+                .vectorize(yi);
 
-    result.compute_root();//.parallel(y);
+        if (scheduleVariant == "compute_at_xi") {
+            neighborhoodWeight.compute_at(result, xi);
+        } else if (scheduleVariant == "compute_at_xo") {
+            // xo and yo are fused into the tile index.
+            neighborhoodWeight.compute_at(result, tileIndex);
+        }
+        if (upstream) {
+            upstream->result.compute_at(result, tileIndex);
+        }
+        return;
+    }
+    if (upstream) {
+        upstream->result.compute_root();
+    }
 }
 
-bool NonlocalMeansFilter::scheduleForGPU() {
+template<typename T>
+void NonlocalMeansFilter<T>::scheduleFusedForCPU() {
+    Var xo, yo, xi, yi, tileIndex, xVector;
+    result.tile(x, y, xo, yo, xi, yi, 32, 32)
+            .fuse(xo, yo, tileIndex)
+            .parallel(tileIndex);
+    result.split(xi, xi, xVector, 8)
+            .vectorize(xVector);
+
+    neighborhoodWeight.compute_at(result, xi);
+
+    // The upstream result (e.g., the gray plane) is computed for each tile,
+    // over the tile grown by the search window and patch radii, instead of
+    // being materialized for the whole image. The upstream schedule is not
+    // applied: its own parallel loops would nest in the parallel tiles.
+    upstream->result.compute_at(result, tileIndex);
+}
+
+template<typename T>
+void NonlocalMeansFilter<T>::scheduleFusedForGPU() {
+    Var xi, yi, xo, yo;
+    result.gpu_tile(x, y, xi, yi, xo, yo, 16, 16);
+
+    // Computed per block into shared memory, by the threads of the block.
+    std::vector<Var> upstreamArgs = upstream->result.args();
+    upstream->result.compute_at(result, xi)
+            .gpu_threads(upstreamArgs[0], upstreamArgs[1]);
+}
+
+template<typename T>
+bool NonlocalMeansFilter<T>::scheduleForGPU() {
     Target target = find_gpu_target();
     if (!target.has_gpu_feature()) {
         return false;
     }
 
-    Var xi, yi, xo, yo;
-    result.gpu_tile(x, y, xi, yi, xo, yo, 16, 16);
+    if (upstream) {
+        scheduleFusedForGPU();
+    } else {
+        Var xi, yi, xo, yo;
+        result.gpu_tile(x, y, xi, yi, xo, yo, 16, 16);
+    }
 
     printf("Target: %s\n", target.to_string().c_str());
     result.compile_jit(target);
@@ -114,3 +256,34 @@ bool NonlocalMeansFilter::scheduleForGPU() {
     return true;
 }
 
+template class NonlocalMeansFilter<uint8_t>;
+template class NonlocalMeansFilter<uint16_t>;
+template class NonlocalMeansFilter<float>;
+
+namespace {
+
+const PipelineRegistry::Registration registration({
+        "nonlocalmeans",
+        "Non-local means denoising",
+        {
+                {"patchSize", 5, "Width of the compared patches", true, true, true},
+                {"searchWindowSize", 13, "Width of the window searched for similar patches", true, true, true},
+                {"h", 0.1, "Degree of filtering", false, true},
+        },
+        1, 1,
+        {"default", "compute_root", "parallel", "tiled", "compute_at_xi", "compute_at_xo"},
+        [](const Type &pixelType, const PipelineParameters &parameters, std::shared_ptr<HalidePipeline> upstream) {
+            return dispatchPixelType(pixelType, [&](auto pixel) -> std::shared_ptr<HalidePipeline> {
+                using T = decltype(pixel);
+                int patchSize = static_cast<int>(parameters.at("patchSize"));
+                int searchWindowSize = static_cast<int>(parameters.at("searchWindowSize"));
+                auto h = static_cast<float>(parameters.at("h"));
+                if (upstream) {
+                    return std::make_shared<NonlocalMeansFilter<T>>(patchSize, searchWindowSize, h, upstream);
+                }
+                return std::make_shared<NonlocalMeansFilter<T>>(patchSize, searchWindowSize, h);
+            });
+        }
+});
+
+}
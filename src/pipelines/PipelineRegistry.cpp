@@ -0,0 +1,202 @@
+
+
+#include "pipelines/PipelineRegistry.h"
+#include <algorithm>
+#include <cmath>
+#include <sstream>
+#include <stdexcept>
+
+namespace {
+
+std::vector<std::string> splitChain(const std::string &chain) {
+    std::vector<std::string> names;
+    std::stringstream stream(chain);
+    std::string name;
+    while (std::getline(stream, name, '+')) {
+        names.push_back(name);
+    }
+    if (names.empty()) {
+        throw std::invalid_argument("Invalid pipeline type: " + chain);
+    }
+    return names;
+}
+
+// The constraints of the parameter, e.g., "positive odd integer", or "" for none.
+std::string describeConstraints(const PipelineParameter &parameter) {
+    std::string constraints = parameter.isPositive ? "positive " : "";
+    if (parameter.isOdd) {
+        constraints += "odd ";
+    }
+    if (parameter.isInteger || parameter.isOdd) {
+        constraints += "integer";
+    } else if (!constraints.empty()) {
+        constraints += "number";
+    }
+    return constraints;
+}
+
+// Parses the whole text as a finite value the parameter allows.
+double parseValue(const PipelineParameter &parameter, const std::string &text) {
+    size_t parsedLength = 0;
+    double value = 0;
+    try {
+        value = std::stod(text, &parsedLength);
+    } catch (std::logic_error &) {
+        parsedLength = 0;
+    }
+    if (parsedLength == 0 || parsedLength != text.size() || !std::isfinite(value)) {
+        throw std::invalid_argument("Invalid value of parameter " + parameter.name + ": " + text);
+    }
+    bool isInteger = value == std::floor(value);
+    bool isAllowed = !((parameter.isInteger || parameter.isOdd) && !isInteger) &&
+                     !(parameter.isPositive && value <= 0) &&
+                     !(parameter.isOdd && std::fmod(value, 2) == 0);
+    if (!isAllowed) {
+        throw std::invalid_argument("Parameter " + parameter.name + " must be a " +
+                                    describeConstraints(parameter) + ": " + text);
+    }
+    return value;
+}
+
+/**
+ * Resolves the parameters of one pipeline of a chain. An assignment applies
+ * to the pipeline if it is qualified by the pipeline's name or unqualified
+ * and the pipeline declares the parameter. Qualified assignments of
+ * parameters the pipeline does not declare are rejected.
+ */
+PipelineParameters resolveParameters(const PipelineDescription &description,
+                                     const std::vector<std::string> &assignments) {
+    PipelineParameters values;
+    for (const PipelineParameter &parameter: description.parameters) {
+        values[parameter.name] = parameter.defaultValue;
+    }
+    for (const std::string &assignment: assignments) {
+        size_t equals = assignment.find('=');
+        if (equals == std::string::npos) {
+            throw std::invalid_argument("Parameters must be given as name=value: " + assignment);
+        }
+        std::string name = assignment.substr(0, equals);
+        size_t dot = name.find('.');
+        bool isQualified = dot != std::string::npos;
+        if (isQualified) {
+            if (name.substr(0, dot) != description.name) {
+                continue;
+            }
+            name = name.substr(dot + 1);
+        }
+        auto parameter = std::find_if(description.parameters.begin(), description.parameters.end(),
+                                      [&name](const PipelineParameter &p) { return p.name == name; });
+        if (parameter == description.parameters.end()) {
+            if (isQualified) {
+                throw std::invalid_argument("Unknown parameter of " + description.name + ": " + name);
+            }
+            continue;
+        }
+        values[name] = parseValue(*parameter, assignment.substr(equals + 1));
+    }
+    return values;
+}
+
+}
+
+PipelineRegistry::Registration::Registration(PipelineDescription description) {
+    std::string name = description.name;
+    instance().descriptions.emplace(name, std::move(description));
+}
+
+PipelineRegistry &PipelineRegistry::instance() {
+    // Constructed on first use, so that registrations from other
+    // translation units do not depend on the static initialization order.
+    static PipelineRegistry registry;
+    return registry;
+}
+
+const PipelineDescription &PipelineRegistry::find(const std::string &name) const {
+    auto it = descriptions.find(name);
+    if (it == descriptions.end()) {
+        throw std::invalid_argument("Invalid pipeline type: " + name);
+    }
+    return it->second;
+}
+
+std::vector<const PipelineDescription *> PipelineRegistry::list() const {
+    std::vector<const PipelineDescription *> list;
+    for (const auto &entry: descriptions) {
+        list.push_back(&entry.second);
+    }
+    return list;
+}
+
+std::shared_ptr<HalidePipeline> PipelineRegistry::create(const std::string &chain, const Type &pixelType,
+                                                         const std::vector<std::string> &assignments,
+                                                         const std::string &scheduleVariant) const {
+    std::vector<std::string> names = splitChain(chain);
+
+    // Every assignment must name a parameter of some pipeline of the chain.
+    for (const std::string &assignment: assignments) {
+        size_t equals = assignment.find('=');
+        if (equals == std::string::npos) {
+            throw std::invalid_argument("Parameters must be given as name=value: " + assignment);
+        }
+        std::string name = assignment.substr(0, equals);
+        size_t dot = name.find('.');
+        std::string qualifier = dot == std::string::npos ? "" : name.substr(0, dot);
+        name = name.substr(dot + 1);
+        bool isDeclared = false;
+        for (const std::string &pipelineName: names) {
+            if (!qualifier.empty() && qualifier != pipelineName) {
+                continue;
+            }
+            for (const PipelineParameter &parameter: find(pipelineName).parameters) {
+                isDeclared |= parameter.name == name;
+            }
+        }
+        if (!isDeclared) {
+            throw std::invalid_argument("Unknown parameter: " + assignment.substr(0, equals));
+        }
+    }
+
+    std::shared_ptr<HalidePipeline> pipeline;
+    const PipelineDescription *previous = nullptr;
+    for (const std::string &name: names) {
+        const PipelineDescription &description = find(name);
+        if (previous && previous->outputChannels != description.inputChannels) {
+            throw std::invalid_argument(name + " cannot follow " + previous->name + ": it expects " +
+                                        std::to_string(description.inputChannels) + " channel(s)");
+        }
+        pipeline = description.create(pixelType, resolveParameters(description, assignments), pipeline);
+        previous = &description;
+    }
+
+    if (!scheduleVariant.empty()) {
+        const std::vector<std::string> &variants = previous->scheduleVariants;
+        if (std::find(variants.begin(), variants.end(), scheduleVariant) == variants.end()) {
+            throw std::invalid_argument("Unknown schedule of " + previous->name + ": " + scheduleVariant);
+        }
+        pipeline->scheduleVariant = scheduleVariant;
+    }
+    return pipeline;
+}
+
+int PipelineRegistry::inputChannels(const std::string &chain) const {
+    return find(splitChain(chain).front()).inputChannels;
+}
+
+void PipelineRegistry::printUsage(std::ostream &stream) const {
+    for (const auto &entry: descriptions) {
+        const PipelineDescription &description = entry.second;
+        stream << description.name << " (" << description.inputChannels << " -> "
+               << description.outputChannels << " channels): " << description.description << std::endl;
+        for (const PipelineParameter &parameter: description.parameters) {
+            std::string constraints = describeConstraints(parameter);
+            stream << "    " << parameter.name << " = " << parameter.defaultValue
+                   << (constraints.empty() ? "" : " (" + constraints + ")") << ": " << parameter.description
+                   << std::endl;
+        }
+        stream << "    schedules:";
+        for (const std::string &variant: description.scheduleVariants) {
+            stream << " " << variant;
+        }
+        stream << std::endl;
+    }
+}
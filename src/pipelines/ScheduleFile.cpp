@@ -0,0 +1,149 @@
+
+
+#include "pipelines/ScheduleFile.h"
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+
+namespace {
+
+// The minimum and maximum numbers of arguments of each directive
+const std::map<std::string, std::pair<int, int>> directiveArities = {
+        {"tile",           {8, 8}},
+        {"split",          {4, 4}},
+        {"fuse",           {3, 3}},
+        {"reorder",        {2, 8}},
+        // The Var, and an optional split factor
+        {"vectorize",      {1, 2}},
+        {"unroll",         {1, 2}},
+        {"parallel",       {1, 1}},
+        {"gpu_tile",       {8, 8}},
+        {"gpu_blocks",     {1, 2}},
+        {"gpu_threads",    {1, 2}},
+        {"compute_root",   {0, 0}},
+        {"compute_at",     {2, 2}},
+        {"compute_with",   {2, 2}},
+        {"compute_inline", {0, 0}},
+        {"store_root",     {0, 0}},
+        {"store_at",       {2, 2}},
+};
+
+}
+
+ScheduleFile::ScheduleFile(const std::string &path) : path(path) {
+    std::ifstream file(path);
+    if (!file) {
+        throw std::invalid_argument("Failed to open the schedule file: " + path);
+    }
+    std::string text;
+    for (int line = 1; std::getline(file, text); line++) {
+        text = text.substr(0, text.find('#'));
+        std::istringstream words(text);
+        Directive directive{line, {}, {}, {}};
+        if (!(words >> directive.func)) {
+            continue;
+        }
+        if (!(words >> directive.name)) {
+            fail(directive, "expected a directive after " + directive.func);
+        }
+        for (std::string argument; words >> argument;) {
+            directive.arguments.push_back(argument);
+        }
+
+        auto arity = directiveArities.find(directive.name);
+        if (arity == directiveArities.end()) {
+            fail(directive, "unknown directive " + directive.name);
+        }
+        auto count = (int) directive.arguments.size();
+        if (count < arity->second.first || count > arity->second.second) {
+            fail(directive, "wrong number of arguments of " + directive.name);
+        }
+        directives.push_back(std::move(directive));
+    }
+}
+
+void ScheduleFile::fail(const Directive &directive, const std::string &message) const {
+    throw std::invalid_argument(path + ":" + std::to_string(directive.line) + ": " + message);
+}
+
+void ScheduleFile::apply(HalidePipeline &pipeline) const {
+    // Funcs are handles: scheduling the copies schedules the pipeline.
+    std::map<std::string, Func> funcs = pipeline.funcs();
+    for (const Directive &directive: directives) {
+        apply(directive, funcs);
+    }
+}
+
+void ScheduleFile::apply(const Directive &directive, const std::map<std::string, Func> &funcs) const {
+    auto findFunc = [&](const std::string &name) {
+        auto it = funcs.find(name);
+        if (it == funcs.end()) {
+            fail(directive, "unknown Func " + name);
+        }
+        return it->second;
+    };
+    // Halide matches the dimensions of a Func by the names of their Vars.
+    auto var = [&](size_t index) {
+        return Var(directive.arguments[index]);
+    };
+    auto factor = [&](size_t index) {
+        try {
+            return std::stoi(directive.arguments[index]);
+        } catch (const std::logic_error &) {
+            fail(directive, "expected an integer instead of " + directive.arguments[index]);
+        }
+    };
+
+    Func func = findFunc(directive.func);
+    const std::string &name = directive.name;
+    const size_t count = directive.arguments.size();
+    if (name == "tile") {
+        func.tile(var(0), var(1), var(2), var(3), var(4), var(5), factor(6), factor(7));
+    } else if (name == "split") {
+        func.split(var(0), var(1), var(2), factor(3));
+    } else if (name == "fuse") {
+        func.fuse(var(0), var(1), var(2));
+    } else if (name == "reorder") {
+        std::vector<VarOrRVar> vars;
+        for (size_t i = 0; i < count; i++) {
+            vars.emplace_back(var(i));
+        }
+        func.reorder(vars);
+    } else if (name == "vectorize" || name == "unroll") {
+        if (name == "vectorize" && count == 1) {
+            func.vectorize(var(0));
+        } else if (name == "vectorize") {
+            func.vectorize(var(0), factor(1));
+        } else if (count == 1) {
+            func.unroll(var(0));
+        } else {
+            func.unroll(var(0), factor(1));
+        }
+    } else if (name == "parallel") {
+        func.parallel(var(0));
+    } else if (name == "gpu_tile") {
+        func.gpu_tile(var(0), var(1), var(2), var(3), var(4), var(5), factor(6), factor(7));
+    } else if (name == "gpu_blocks" || name == "gpu_threads") {
+        if (name == "gpu_blocks" && count == 1) {
+            func.gpu_blocks(var(0));
+        } else if (name == "gpu_blocks") {
+            func.gpu_blocks(var(0), var(1));
+        } else if (count == 1) {
+            func.gpu_threads(var(0));
+        } else {
+            func.gpu_threads(var(0), var(1));
+        }
+    } else if (name == "compute_root") {
+        func.compute_root();
+    } else if (name == "compute_at") {
+        func.compute_at(findFunc(directive.arguments[0]), var(1));
+    } else if (name == "compute_with") {
+        func.compute_with(findFunc(directive.arguments[0]), var(1));
+    } else if (name == "compute_inline") {
+        func.compute_inline();
+    } else if (name == "store_root") {
+        func.store_root();
+    } else if (name == "store_at") {
+        func.store_at(findFunc(directive.arguments[0]), var(1));
+    }
+}
@@ -0,0 +1,281 @@
+#ifdef HALIDE_EXPERIMENTS_WITH_ZLIB
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <thread>
+#include <vector>
+#include <zlib.h>
+#include "pngwriter.h"
+#include "WorkStealingPool.h"
+
+namespace {
+
+const int filterCount = 5;
+
+struct Strip {
+    int firstRow;
+    int rowCount;
+    bool isLast;
+
+    std::vector<uint8_t> deflated;
+    uLong adler;
+    uLong uncompressedSize;
+    // CRC-32 of the deflated bytes only
+    uLong crc;
+    bool isValid;
+};
+
+// crc32() returns its initial value for a null buffer, so empty spans are skipped.
+uLong updateCrc(uLong crc, const uint8_t *data, size_t size) {
+    return size > 0 ? crc32(crc, data, size) : crc;
+}
+
+uint8_t paeth(int a, int b, int c) {
+    int p = a + b - c;
+    int pa = abs(p - a);
+    int pb = abs(p - b);
+    int pc = abs(p - c);
+    if (pa <= pb && pa <= pc) {
+        return a;
+    }
+    return pb <= pc ? b : c;
+}
+
+// Filters one row; `previous` is nullptr for the first row of the image,
+// which PNG defines to be predicted from zeros.
+void filterRow(const uint8_t *row, const uint8_t *previous, int rowBytes, int bytesPerPixel,
+               int filter, uint8_t *filtered) {
+    for (int i = 0; i < rowBytes; i++) {
+        int left = i >= bytesPerPixel ? row[i - bytesPerPixel] : 0;
+        int up = previous ? previous[i] : 0;
+        int upLeft = previous && i >= bytesPerPixel ? previous[i - bytesPerPixel] : 0;
+        int predicted = 0;
+        switch (filter) {
+            case 1:
+                predicted = left;
+                break;
+            case 2:
+                predicted = up;
+                break;
+            case 3:
+                predicted = (left + up) / 2;
+                break;
+            case 4:
+                predicted = paeth(left, up, upLeft);
+                break;
+            default:
+                break;
+        }
+        filtered[i] = (uint8_t) (row[i] - predicted);
+    }
+}
+
+// Filters the row with the requested filter, or the one that minimizes
+// the sum of absolute differences (the same heuristic as stb_image_write).
+void filterRowAdaptive(const uint8_t *row, const uint8_t *previous, int rowBytes, int bytesPerPixel,
+                       int requestedFilter, std::vector<uint8_t> &scratch, uint8_t *filteredWithType) {
+    if (requestedFilter >= 0) {
+        filteredWithType[0] = (uint8_t) requestedFilter;
+        filterRow(row, previous, rowBytes, bytesPerPixel, requestedFilter, filteredWithType + 1);
+        return;
+    }
+    long bestScore = -1;
+    for (int filter = 0; filter < filterCount; filter++) {
+        filterRow(row, previous, rowBytes, bytesPerPixel, filter, scratch.data());
+        long score = 0;
+        for (int i = 0; i < rowBytes; i++) {
+            score += abs((int8_t) scratch[i]);
+        }
+        if (bestScore < 0 || score < bestScore) {
+            bestScore = score;
+            filteredWithType[0] = (uint8_t) filter;
+            std::copy(scratch.begin(), scratch.begin() + rowBytes, filteredWithType + 1);
+        }
+    }
+}
+
+// Returns the row as PNG expects it: 16-bit samples are stored in big-endian order.
+const uint8_t *pngRow(const Buffer<> &image, int row, std::vector<uint8_t> &swapped) {
+    int bytesPerSample = image.type().bytes();
+    size_t rowBytes = (size_t) image.width() * image.channels() * bytesPerSample;
+    auto *data = (const uint8_t *) image.data() + (size_t) row * image.dim(1).stride() * bytesPerSample;
+    if (bytesPerSample == 1) {
+        return data;
+    }
+    swapped.assign(data, data + rowBytes);
+    for (size_t i = 0; i < rowBytes; i += 2) {
+        std::swap(swapped[i], swapped[i + 1]);
+    }
+    return swapped.data();
+}
+
+void encodeStrip(const Buffer<> &image, const PngOptions &pngOptions, Strip &strip) {
+    int bytesPerPixel = image.channels() * image.type().bytes();
+    int rowBytes = image.width() * bytesPerPixel;
+
+    std::vector<uint8_t> filtered((size_t) (rowBytes + 1) * strip.rowCount);
+    std::vector<uint8_t> scratch(rowBytes);
+    std::vector<uint8_t> currentSwapped;
+    std::vector<uint8_t> previousSwapped;
+    const uint8_t *previous = strip.firstRow > 0 ? pngRow(image, strip.firstRow - 1, previousSwapped) : nullptr;
+    for (int i = 0; i < strip.rowCount; i++) {
+        const uint8_t *current = pngRow(image, strip.firstRow + i, currentSwapped);
+        filterRowAdaptive(current, previous, rowBytes, bytesPerPixel,
+                          pngOptions.filter, scratch, filtered.data() + (size_t) i * (rowBytes + 1));
+        // The swapped copies (if any) trade places, keeping `previous` valid.
+        std::swap(currentSwapped, previousSwapped);
+        previous = image.type().bytes() == 1 ? current : previousSwapped.data();
+    }
+    strip.uncompressedSize = filtered.size();
+    strip.adler = adler32(adler32(0L, Z_NULL, 0), filtered.data(), filtered.size());
+
+    // Raw deflate: the zlib header and checksum are added once for the whole image.
+    z_stream stream{};
+    if (deflateInit2(&stream, pngOptions.compressionLevel, Z_DEFLATED, -MAX_WBITS, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+        strip.isValid = false;
+        return;
+    }
+    strip.deflated.resize(deflateBound(&stream, filtered.size()) + 16);
+    stream.next_in = filtered.data();
+    stream.avail_in = filtered.size();
+    stream.next_out = strip.deflated.data();
+    stream.avail_out = strip.deflated.size();
+    // A sync flush ends on a byte boundary without marking the last block,
+    // so that the next strip's blocks can follow directly.
+    int result = deflate(&stream, strip.isLast ? Z_FINISH : Z_SYNC_FLUSH);
+    strip.isValid = strip.isLast ? result == Z_STREAM_END : result == Z_OK && stream.avail_in == 0;
+    strip.deflated.resize(stream.total_out);
+    deflateEnd(&stream);
+
+    strip.crc = updateCrc(crc32(0L, Z_NULL, 0), strip.deflated.data(), strip.deflated.size());
+}
+
+// fwrite() must not be given a null pointer, which empty vectors may have.
+void writeBytes(FILE *file, const uint8_t *data, size_t size) {
+    if (size > 0) {
+        fwrite(data, 1, size, file);
+    }
+}
+
+void writeBigEndian32(FILE *file, uint32_t value) {
+    uint8_t bytes[4] = {(uint8_t) (value >> 24), (uint8_t) (value >> 16), (uint8_t) (value >> 8), (uint8_t) value};
+    fwrite(bytes, 1, sizeof(bytes), file);
+}
+
+void writeChunk(FILE *file, const char *type, const uint8_t *data, uint32_t size) {
+    writeBigEndian32(file, size);
+    fwrite(type, 1, 4, file);
+    writeBytes(file, data, size);
+    uLong crc = crc32(0L, (const Bytef *) type, 4);
+    writeBigEndian32(file, updateCrc(crc, data, size));
+}
+
+// Writes an IDAT chunk made of prefix + strip + suffix without copying the strip.
+void writeStripChunk(FILE *file, const Strip &strip,
+                     const std::vector<uint8_t> &prefix, const std::vector<uint8_t> &suffix) {
+    writeBigEndian32(file, prefix.size() + strip.deflated.size() + suffix.size());
+    fwrite("IDAT", 1, 4, file);
+    writeBytes(file, prefix.data(), prefix.size());
+    writeBytes(file, strip.deflated.data(), strip.deflated.size());
+    writeBytes(file, suffix.data(), suffix.size());
+
+    uLong crc = crc32(0L, (const Bytef *) "IDAT", 4);
+    crc = updateCrc(crc, prefix.data(), prefix.size());
+    crc = crc32_combine(crc, strip.crc, (z_off_t) strip.deflated.size());
+    crc = updateCrc(crc, suffix.data(), suffix.size());
+    writeBigEndian32(file, crc);
+}
+
+}
+
+bool writePngParallel(const Buffer<> &image, const std::string &targetFilePath,
+                      const PngOptions &pngOptions) {
+    // PNG color types for gray, gray + alpha, RGB and RGBA
+    const uint8_t colorTypes[] = {0, 4, 2, 6};
+    if (image.channels() < 1 || image.channels() > 4 ||
+        !image.type().is_uint() || (image.type().bits() != 8 && image.type().bits() != 16)) {
+        return false;
+    }
+
+    WorkStealingPool *pool = WorkStealingPool::current();
+    int threadCount = pngOptions.threads;
+    if (threadCount <= 0) {
+        threadCount = pool ? pool->threadCount() + 1 : (int) std::thread::hardware_concurrency();
+    }
+    int stripCount = std::max(1, std::min(threadCount, image.height()));
+    int rowsPerStrip = std::max(1, (image.height() + stripCount - 1) / stripCount);
+    std::vector<Strip> strips;
+    for (int firstRow = 0; firstRow < image.height(); firstRow += rowsPerStrip) {
+        Strip strip{};
+        strip.firstRow = firstRow;
+        strip.rowCount = std::min(rowsPerStrip, image.height() - firstRow);
+        strip.isLast = firstRow + strip.rowCount == image.height();
+        strips.push_back(strip);
+    }
+    if (strips.empty()) {
+        // Without rows, a single empty final block, as the image data must have an IDAT chunk.
+        Strip strip{};
+        strip.isLast = true;
+        strips.push_back(strip);
+    }
+
+    // On the pool if there is one, so that the strips do not compete with its workers for the cores.
+    if (strips.size() == 1) {
+        encodeStrip(image, pngOptions, strips.front());
+    } else if (pool) {
+        pool->parallelFor(0, (int) strips.size(), [&image, &pngOptions, &strips](int i) {
+            encodeStrip(image, pngOptions, strips[i]);
+            return 0;
+        });
+    } else {
+        std::vector<std::thread> workers;
+        for (auto &strip: strips) {
+            workers.emplace_back(encodeStrip, std::cref(image), std::cref(pngOptions), std::ref(strip));
+        }
+        for (auto &worker: workers) {
+            worker.join();
+        }
+    }
+
+    uLong adler = adler32(0L, Z_NULL, 0);
+    for (const auto &strip: strips) {
+        if (!strip.isValid) {
+            return false;
+        }
+        adler = adler32_combine(adler, strip.adler, (z_off_t) strip.uncompressedSize);
+    }
+
+    FILE *file = fopen(targetFilePath.c_str(), "wb");
+    if (!file) {
+        return false;
+    }
+    const uint8_t signature[] = {137, 80, 78, 71, 13, 10, 26, 10};
+    fwrite(signature, 1, sizeof(signature), file);
+
+    uint8_t header[13] = {
+            (uint8_t) (image.width() >> 24), (uint8_t) (image.width() >> 16),
+            (uint8_t) (image.width() >> 8), (uint8_t) image.width(),
+            (uint8_t) (image.height() >> 24), (uint8_t) (image.height() >> 16),
+            (uint8_t) (image.height() >> 8), (uint8_t) image.height(),
+            (uint8_t) image.type().bits(), colorTypes[image.channels() - 1], 0, 0, 0
+    };
+    writeChunk(file, "IHDR", header, sizeof(header));
+
+    // zlib header: deflate with a 32K window, no preset dictionary.
+    const std::vector<uint8_t> zlibHeader = {0x78, 0x9C};
+    const std::vector<uint8_t> adlerTrailer = {(uint8_t) (adler >> 24), (uint8_t) (adler >> 16),
+                                               (uint8_t) (adler >> 8), (uint8_t) adler};
+    const std::vector<uint8_t> none;
+    for (size_t i = 0; i < strips.size(); i++) {
+        writeStripChunk(file, strips[i],
+                        i == 0 ? zlibHeader : none,
+                        strips[i].isLast ? adlerTrailer : none);
+    }
+    writeChunk(file, "IEND", nullptr, 0);
+
+    bool isWritten = !ferror(file);
+    return fclose(file) == 0 && isWritten;
+}
+
+#endif
@@ -0,0 +1,248 @@
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <memory>
+#include <stdexcept>
+#include <vector>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "pages.h"
+#include "rawimage.h"
+
+namespace {
+
+const char rawImageMagic[8] = {'H', 'L', 'R', 'A', 'W', 'I', 'M', 'G'};
+// Version 2 added the byte order mark.
+const uint32_t rawImageVersion = 2;
+const uint32_t rawImagePayloadAlignment = 4096;
+
+// Room before a mapped payload for Halide's allocation header, which
+// puts the buffer's pixels at the next multiple of 128 bytes after it
+constexpr size_t allocationHeaderRoom = 128;
+static_assert(sizeof(Halide::Runtime::AllocationHeader) <= allocationHeaderRoom,
+              "Halide's allocation header must fit before the payload");
+
+// Recorded just before the allocation header, for unmapping the file with the buffer
+struct FileMapping {
+    void *address;
+    size_t size;
+};
+
+// The storage the next call of adoptMapping() hands out on this thread
+thread_local void *pendingStorage = nullptr;
+
+// An allocation function for Buffer::allocate() that allocates nothing,
+// but returns the room before a mapped payload.
+void *adoptMapping(size_t) {
+    return pendingStorage;
+}
+
+void unmapFile(void *storage) {
+    FileMapping mapping;
+    memcpy(&mapping, static_cast<char *>(storage) - sizeof(FileMapping), sizeof(mapping));
+    munmap(mapping.address, mapping.size);
+}
+
+uint64_t roundUp(uint64_t value, uint64_t multiple) {
+    return (value + multiple - 1) / multiple * multiple;
+}
+
+void validateHeader(const RawImageHeader &header, uint64_t fileSize, const std::string &filePath) {
+    auto fail = [&filePath](const std::string &reason) {
+        throw std::runtime_error("Invalid raw image " + filePath + ": " + reason);
+    };
+    if (memcmp(header.magic, rawImageMagic, sizeof(rawImageMagic)) != 0) {
+        fail("bad magic");
+    }
+    if (header.version != rawImageVersion) {
+        fail("unsupported version " + std::to_string(header.version));
+    }
+    if (header.byteOrderMark != rawImageByteOrderMark) {
+        fail("written in the other byte order");
+    }
+    if (header.dimensions == 0 || header.dimensions > rawImageMaxDimensions) {
+        fail("unsupported number of dimensions " + std::to_string(header.dimensions));
+    }
+    bool isKnownCode = header.typeCode == halide_type_int || header.typeCode == halide_type_uint ||
+                       header.typeCode == halide_type_float || header.typeCode == halide_type_bfloat;
+    if (!isKnownCode) {
+        fail("unknown type code " + std::to_string(header.typeCode));
+    }
+    if (header.typeBits != 8 && header.typeBits != 16 && header.typeBits != 32 && header.typeBits != 64) {
+        fail("unsupported type of " + std::to_string(header.typeBits) + " bits");
+    }
+    // The alignment is a power of two, of which the payload offset is a multiple.
+    if (header.alignment == 0 || (header.alignment & (header.alignment - 1)) != 0 ||
+        header.payloadOffset % header.alignment != 0) {
+        fail("misaligned payload");
+    }
+    // Compared without adding, so that nothing can wrap around.
+    if (header.payloadOffset < sizeof(RawImageHeader) || header.payloadOffset > fileSize ||
+        header.payloadSize > fileSize - header.payloadOffset ||
+        header.originOffset > header.payloadSize) {
+        fail("payload out of bounds");
+    }
+
+    // The elements span [lowest, highest] bytes from the origin, which must lie in the payload.
+    const auto payloadSize = (int64_t) header.payloadSize;
+    const int64_t elementBytes = header.typeBits / 8;
+    int64_t lowest = 0;
+    int64_t highest = 0;
+    bool isEmpty = false;
+    for (int d = 0; d < header.dimensions; d++) {
+        if (header.extents[d] < 0) {
+            fail("negative extent in dimension " + std::to_string(d));
+        }
+        if (header.extents[d] == 0) {
+            isEmpty = true;
+            continue;
+        }
+        // At most 2^31 * 2^31, which fits.
+        int64_t span = (int64_t) (header.extents[d] - 1) * header.strides[d];
+        if (span > payloadSize / elementBytes || span < -payloadSize / elementBytes) {
+            fail("dimension " + std::to_string(d) + " exceeds the payload");
+        }
+        (span > 0 ? highest : lowest) += span * elementBytes;
+        // Each step adds at most payloadSize, so checking as we go keeps the sums in range.
+        if (highest > payloadSize || lowest < -payloadSize) {
+            fail("dimension " + std::to_string(d) + " exceeds the payload");
+        }
+    }
+    if (!isEmpty && ((int64_t) header.originOffset + lowest < 0 ||
+                     (int64_t) header.originOffset + highest + elementBytes > payloadSize)) {
+        fail("pixels out of the payload");
+    }
+}
+
+}
+
+bool isRawImagePath(const std::string &filePath) {
+    std::string extension = rawImageExtension;
+    return filePath.size() >= extension.size() &&
+           filePath.compare(filePath.size() - extension.size(), extension.size(), extension) == 0;
+}
+
+Buffer<> loadRawImage(const std::string &filePath) {
+    int fd = open(filePath.c_str(), O_RDONLY);
+    if (fd < 0) {
+        throw std::runtime_error("Error opening raw image " + filePath + ": " + strerror(errno));
+    }
+    struct stat fileStat{};
+    if (fstat(fd, &fileStat) != 0 || (size_t) fileStat.st_size < sizeof(RawImageHeader)) {
+        close(fd);
+        throw std::runtime_error("Invalid raw image " + filePath + ": truncated header");
+    }
+    size_t fileSize = fileStat.st_size;
+    // Writable, as Halide writes its allocation header before the pixels;
+    // the written pages are copied, and the file left untouched.
+    void *address = mmap(nullptr, fileSize, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (address == MAP_FAILED) {
+        throw std::runtime_error("Error mapping raw image " + filePath + ": " + strerror(errno));
+    }
+    auto unmap = [fileSize](void *mapping) {
+        munmap(mapping, fileSize);
+    };
+    std::unique_ptr<void, decltype(unmap)> mapping(address, unmap);
+
+    RawImageHeader header{};
+    memcpy(&header, address, sizeof(header));
+    validateHeader(header, fileSize, filePath);
+
+    halide_type_t type((halide_type_code_t) header.typeCode, header.typeBits);
+    halide_dimension_t shape[rawImageMaxDimensions];
+    for (int d = 0; d < header.dimensions; d++) {
+        shape[d] = halide_dimension_t(header.mins[d], header.extents[d], header.strides[d]);
+    }
+    uint8_t *payload = (uint8_t *) address + header.payloadOffset;
+    Buffer<> pixels(type, payload + header.originOffset, header.dimensions, shape);
+
+    // Buffer::allocate() puts the pixels at the start of the allocation,
+    // so only payloads starting at their first element can be adopted.
+    bool isAdoptable = header.originOffset == 0 && header.payloadOffset % allocationHeaderRoom == 0 &&
+                       header.payloadOffset >= allocationHeaderRoom + sizeof(FileMapping);
+    for (int d = 0; d < header.dimensions; d++) {
+        isAdoptable = isAdoptable && shape[d].stride >= 0;
+    }
+    Buffer<> adopted;
+    if (isAdoptable) {
+        uint8_t *storage = payload - allocationHeaderRoom;
+        FileMapping fileMapping{address, fileSize};
+        memcpy(storage - sizeof(FileMapping), &fileMapping, sizeof(fileMapping));
+        adopted = Buffer<>(type, nullptr, header.dimensions, shape);
+        pendingStorage = storage;
+        adopted.allocate(adoptMapping, unmapFile);
+        pendingStorage = nullptr;
+        // The buffer unmaps the file from now on.
+        mapping.release();
+        if (adopted.raw_buffer()->host == payload) {
+            // Signal for the GPU that the buffer's changed.
+            adopted.set_host_dirty();
+            return adopted;
+        }
+        // A Halide placing the pixels elsewhere: copied below, while the adopted buffer keeps the file mapped.
+    }
+
+    // The same layout, padding included, but running forward: the
+    // buffer's allocation starts at its first element.
+    for (int d = 0; d < header.dimensions; d++) {
+        shape[d].stride = std::abs(shape[d].stride);
+    }
+    Buffer<> image = allocateBuffer(type, header.dimensions, shape);
+    image.copy_from(pixels);
+    // Signal for the GPU that the buffer's changed.
+    image.set_host_dirty();
+    return image;
+}
+
+Type probeRawPixelType(const std::string &filePath) {
+    std::ifstream file(filePath, std::ios::binary | std::ios::ate);
+    if (!file) {
+        throw std::runtime_error("Error opening raw image " + filePath);
+    }
+    auto fileSize = (uint64_t) file.tellg();
+    RawImageHeader header{};
+    if (fileSize < sizeof(header) || !file.seekg(0).read((char *) &header, sizeof(header))) {
+        throw std::runtime_error("Invalid raw image " + filePath + ": truncated header");
+    }
+    validateHeader(header, fileSize, filePath);
+    return {(halide_type_code_t) header.typeCode, header.typeBits, 1};
+}
+
+void saveRawImage(const Buffer<> &image, const std::string &targetFilePath) {
+    if (image.dimensions() == 0 || image.dimensions() > rawImageMaxDimensions) {
+        throw std::runtime_error("Cannot save a " + std::to_string(image.dimensions()) +
+                                 "-dimensional buffer as a raw image.");
+    }
+    const halide_buffer_t *raw = image.raw_buffer();
+    const uint8_t *begin = raw->begin();
+
+    RawImageHeader header{};
+    memcpy(header.magic, rawImageMagic, sizeof(rawImageMagic));
+    header.version = rawImageVersion;
+    header.byteOrderMark = rawImageByteOrderMark;
+    header.typeCode = raw->type.code;
+    header.typeBits = raw->type.bits;
+    header.dimensions = image.dimensions();
+    for (int d = 0; d < image.dimensions(); d++) {
+        header.mins[d] = image.dim(d).min();
+        header.extents[d] = image.dim(d).extent();
+        header.strides[d] = image.dim(d).stride();
+    }
+    header.alignment = rawImagePayloadAlignment;
+    header.originOffset = raw->host - begin;
+    header.payloadOffset = roundUp(sizeof(header), rawImagePayloadAlignment);
+    header.payloadSize = raw->end() - begin;
+
+    std::ofstream file(targetFilePath, std::ios::binary | std::ios::trunc);
+    std::vector<char> padding(header.payloadOffset - sizeof(header), 0);
+    file.write((const char *) &header, sizeof(header));
+    file.write(padding.data(), (std::streamsize) padding.size());
+    file.write((const char *) begin, (std::streamsize) header.payloadSize);
+    if (!file) {
+        throw std::runtime_error("Error writing raw image " + targetFilePath);
+    }
+}
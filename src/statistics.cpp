@@ -0,0 +1,327 @@
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <string>
+#include "statistics.h"
+
+namespace {
+
+// -1 where an event was not counted
+double ratio(const PerfCounts &counts, PerfEvent numerator, PerfEvent denominator, double scale = 1) {
+    auto n = counts.find(numerator);
+    auto d = counts.find(denominator);
+    if (n == counts.end() || d == counts.end() || d->second == 0) {
+        return -1;
+    }
+    return scale * (double) n->second / (double) d->second;
+}
+
+std::string formatRatio(double value) {
+    if (value < 0) {
+        return "n/a";
+    }
+    char text[32];
+    snprintf(text, sizeof(text), "%.2f", value);
+    return text;
+}
+
+}
+
+double percentile(std::vector<double> &samples, double fraction) {
+    if (samples.empty()) {
+        return 0;
+    }
+    std::sort(samples.begin(), samples.end());
+    auto rank = (size_t) std::ceil(fraction * samples.size());
+    return samples[std::min(samples.size() - 1, rank > 0 ? rank - 1 : 0)];
+}
+
+void printBatchReport(const BatchReport &report) {
+    printf("\nProcessed %zu images in %.2f ms\n", report.processedImages, report.elapsedTime * 1000);
+    if (report.processedImages == 0 || report.elapsedTime <= 0) {
+        return;
+    }
+    printf("Throughput: %.2f images/s, %.2f megapixels/s\n",
+           report.processedImages / report.elapsedTime,
+           report.processedPixels / 1e6 / report.elapsedTime);
+
+    std::vector<double> latencies = report.latencies;
+    printf("Latency [ms]: p50 %.2f, p90 %.2f, p99 %.2f, max %.2f\n",
+           percentile(latencies, 0.5) * 1000, percentile(latencies, 0.9) * 1000,
+           percentile(latencies, 0.99) * 1000, latencies.back() * 1000);
+    printLatencyHistogram(report.latencies);
+}
+
+void printLatencyHistogram(const std::vector<double> &latencies) {
+    const int barWidth = 50;
+    // Bucket i holds latencies in [2^(i-1), 2^i) ms; bucket 0 holds those below 1 ms.
+    std::vector<size_t> buckets;
+    for (double latency: latencies) {
+        double milliseconds = latency * 1000;
+        auto bucket = milliseconds < 1 ? 0 : (size_t) std::floor(std::log2(milliseconds)) + 1;
+        if (bucket >= buckets.size()) {
+            buckets.resize(bucket + 1, 0);
+        }
+        buckets[bucket]++;
+    }
+    size_t largestBucket = buckets.empty() ? 0 : *std::max_element(buckets.begin(), buckets.end());
+
+    printf("\nLatency histogram:\n");
+    for (size_t i = 0; i < buckets.size(); i++) {
+        double lower = i == 0 ? 0 : std::ldexp(1.0, (int) i - 1);
+        double upper = std::ldexp(1.0, (int) i);
+        int bar = (int) (buckets[i] * barWidth / std::max<size_t>(largestBucket, 1));
+        printf("  [%7g, %7g) ms %6zu %s\n", lower, upper, buckets[i], std::string(bar, '#').c_str());
+    }
+}
+
+void printScheduleTable(const std::vector<ScheduleTiming> &timings) {
+    auto fastest = std::min_element(timings.begin(), timings.end(),
+                                    [](const ScheduleTiming &a, const ScheduleTiming &b) {
+                                        return a.executionTime < b.executionTime;
+                                    });
+    size_t width = std::string("**CPU Scheduling**").size();
+    for (const ScheduleTiming &timing: timings) {
+        width = std::max(width, timing.schedule.size());
+    }
+
+    bool hasCounts = std::any_of(timings.begin(), timings.end(), [](const ScheduleTiming &timing) {
+        return !timing.counts.empty();
+    });
+
+    printf("\n| %-*s | **Ex. time [ms]** |", (int) width, "**CPU Scheduling**");
+    printf(hasCounts ? " **IPC** | **L1D MPKI** | **LLC MPKI** | **dTLB MPKI** |\n" : "\n");
+    printf("|%s|-------------------|", std::string(width + 2, '-').c_str());
+    printf(hasCounts ? "---------|--------------|--------------|---------------|\n" : "\n");
+    for (auto it = timings.begin(); it != timings.end(); ++it) {
+        char time[32];
+        snprintf(time, sizeof(time), it == fastest ? "**%.2f**" : "%.2f", it->executionTime * 1000);
+        printf("| %-*s | %17s |", (int) width, it->schedule.c_str(), time);
+        if (hasCounts) {
+            const PerfCounts &counts = it->counts;
+            printf(" %7s | %12s | %12s | %13s |",
+                   formatRatio(ratio(counts, PerfEvent::Instructions, PerfEvent::Cycles)).c_str(),
+                   formatRatio(ratio(counts, PerfEvent::L1DataMisses, PerfEvent::Instructions, 1000)).c_str(),
+                   formatRatio(ratio(counts, PerfEvent::LastLevelCacheMisses, PerfEvent::Instructions, 1000)).c_str(),
+                   formatRatio(ratio(counts, PerfEvent::DataTlbMisses, PerfEvent::Instructions, 1000)).c_str());
+        }
+        printf("\n");
+    }
+}
+
+void printThroughput(const PipelineCost &cost, double executionTime, const MachinePeaks &peaks) {
+    double pixelRate = (double) cost.pixels / executionTime;
+    printf("Throughput: %.2f megapixels/s, %.1f bytes/pixel (%.2f GB/s), %.0f operations/pixel (%.2f GFLOP/s)\n",
+           pixelRate / 1e6, cost.bytesPerPixel, pixelRate * cost.bytesPerPixel / 1e9,
+           cost.operationsPerPixel, pixelRate * cost.operationsPerPixel / 1e9);
+    if (peaks.memoryBandwidth <= 0 || peaks.operationRate <= 0) {
+        return;
+    }
+    double intensity = cost.operationsPerPixel / cost.bytesPerPixel;
+    double attainable = std::min(peaks.operationRate, intensity * peaks.memoryBandwidth);
+    printf("Roofline: %.1f%% of the attainable %.2f GFLOP/s (%s-bound at %.1f operations/byte; "
+           "peaks %.1f GB/s, %.1f GFLOP/s)\n",
+           100 * pixelRate * cost.operationsPerPixel / attainable, attainable / 1e9,
+           attainable < peaks.operationRate ? "memory" : "compute", intensity,
+           peaks.memoryBandwidth / 1e9, peaks.operationRate / 1e9);
+}
+
+void printRooflineTable(const std::vector<ScheduleTiming> &timings, const PipelineCost &cost,
+                        const MachinePeaks &peaks) {
+    bool hasPeaks = peaks.memoryBandwidth > 0 && peaks.operationRate > 0;
+    double attainable = 0;
+    if (hasPeaks) {
+        double intensity = cost.operationsPerPixel / cost.bytesPerPixel;
+        attainable = std::min(peaks.operationRate, intensity * peaks.memoryBandwidth);
+    }
+    size_t width = std::string("**CPU Scheduling**").size();
+    for (const ScheduleTiming &timing: timings) {
+        width = std::max(width, timing.schedule.size());
+    }
+
+    printf("\n| %-*s | **MPixel/s** | **GB/s** | **GFLOP/s** |", (int) width, "**CPU Scheduling**");
+    printf(hasPeaks ? " **Roofline** |\n" : "\n");
+    printf("|%s|-------------|----------|-------------|", std::string(width + 2, '-').c_str());
+    printf(hasPeaks ? "--------------|\n" : "\n");
+    for (const ScheduleTiming &timing: timings) {
+        double pixelRate = (double) cost.pixels / timing.executionTime;
+        double operationRate = pixelRate * cost.operationsPerPixel;
+        printf("| %-*s | %11.2f | %8.2f | %11.2f |", (int) width, timing.schedule.c_str(), pixelRate / 1e6,
+               pixelRate * cost.bytesPerPixel / 1e9, operationRate / 1e9);
+        if (hasPeaks) {
+            printf(" %11.1f%% |", 100 * operationRate / attainable);
+        }
+        printf("\n");
+    }
+}
+
+void printPerfCounts(const PerfCounts &counts) {
+    if (counts.empty()) {
+        printf("Hardware counters are not available (see /proc/sys/kernel/perf_event_paranoid).\n");
+        return;
+    }
+    printf("Per rep:");
+    const char *separator = " ";
+    for (PerfEvent event: PerfCounters::allEvents()) {
+        auto count = counts.find(event);
+        if (count == counts.end()) {
+            printf("%s%s n/a", separator, PerfCounters::name(event).c_str());
+        } else {
+            printf("%s%.4g %s", separator, (double) count->second, PerfCounters::name(event).c_str());
+        }
+        separator = ", ";
+    }
+    printf("\n  IPC %s, misses per 1000 instructions: L1D %s, LLC %s, dTLB %s\n",
+           formatRatio(ratio(counts, PerfEvent::Instructions, PerfEvent::Cycles)).c_str(),
+           formatRatio(ratio(counts, PerfEvent::L1DataMisses, PerfEvent::Instructions, 1000)).c_str(),
+           formatRatio(ratio(counts, PerfEvent::LastLevelCacheMisses, PerfEvent::Instructions, 1000)).c_str(),
+           formatRatio(ratio(counts, PerfEvent::DataTlbMisses, PerfEvent::Instructions, 1000)).c_str());
+}
+
+void printCallOverheadTable(const std::vector<CallOverheadTiming> &timings) {
+    printf("\n| **Size** | **realize() [us/call]** | **Callable [us/call]** | **Saved [us/call]** |\n");
+    printf("|----------|-------------------------|------------------------|---------------------|\n");
+    for (const CallOverheadTiming &timing: timings) {
+        printf("| %4dx%-4d| %23.2f | %22.2f | %19.2f |\n", timing.size, timing.size,
+               timing.realizeTime * 1e6, timing.callableTime * 1e6,
+               (timing.realizeTime - timing.callableTime) * 1e6);
+    }
+}
+
+void printArenaStatistics(const ArenaStatistics &statistics) {
+    uint64_t blocks = statistics.reusedBlocks + statistics.freshBlocks;
+    uint64_t bytes = statistics.reusedBytes + statistics.freshBytes;
+    printf("\nBuffer arena: %llu allocations, %.1f MB\n", (unsigned long long) blocks, bytes / 1e6);
+    printf("  reused: %llu allocations, %.1f MB (%.1f%% of the bytes)\n",
+           (unsigned long long) statistics.reusedBlocks, statistics.reusedBytes / 1e6,
+           bytes > 0 ? 100.0 * statistics.reusedBytes / bytes : 0.0);
+    printf("  fresh:  %llu allocations, %.1f MB\n", (unsigned long long) statistics.freshBlocks,
+           statistics.freshBytes / 1e6);
+    printf("  retained: %.1f MB\n", statistics.retainedBytes / 1e6);
+}
+
+void printPagePolicyTable(const std::vector<PagePolicyTiming> &timings) {
+    printf("\n| **Pages**         | **Allocation [ms]** | **Warmup [ms]** | **Warmup faults** | **Execution [ms/rep]** "
+           "| **dTLB misses/rep** |\n");
+    printf("|-------------------|---------------------|-----------------|-------------------|------------------------"
+           "|---------------------|\n");
+    bool hasFallbacks = false;
+    for (const PagePolicyTiming &timing: timings) {
+        std::string tlbMisses = timing.tlbMissesPerRep < 0 ? "n/a" : std::to_string(timing.tlbMissesPerRep);
+        // Marked, as the row then measures transparent huge pages, in part or in full.
+        std::string policy = timing.hugetlbFallbacks > 0 ? timing.policy + "*" : timing.policy;
+        hasFallbacks = hasFallbacks || timing.hugetlbFallbacks > 0;
+        printf("| %-17s | %19.2f | %15.2f | %17llu | %22.2f | %19s |\n", policy.c_str(),
+               timing.allocationTime * 1000, timing.warmupTime * 1000,
+               (unsigned long long) timing.warmupPageFaults, timing.executionTime * 1000, tlbMisses.c_str());
+    }
+    if (hasFallbacks) {
+        printf("\n* Backed in part or in full by transparent huge pages: ");
+        for (const PagePolicyTiming &timing: timings) {
+            if (timing.hugetlbFallbacks > 0) {
+                printf("%s %llu allocations, ", timing.policy.c_str(), (unsigned long long) timing.hugetlbFallbacks);
+            }
+        }
+        printf("as no reserved huge pages were left (see /proc/sys/vm/nr_hugepages).\n");
+    }
+}
+
+void printScalingReport(const std::vector<ScalingTiming> &timings) {
+    if (timings.empty()) {
+        return;
+    }
+    const double baseTime = timings.front().executionTime * timings.front().threads;
+    printf("\n| **Threads** | **Execution [ms/rep]** | **Speedup** | **Efficiency** | **Triad bandwidth [GB/s]** |\n");
+    printf("|-------------|------------------------|-------------|----------------|----------------------------|\n");
+    for (const ScalingTiming &timing: timings) {
+        double speedup = baseTime / timing.executionTime;
+        printf("| %11d | %22.2f | %10.2fx | %13.0f%% | %26.1f |\n", timing.threads, timing.executionTime * 1000,
+               speedup, 100 * speedup / timing.threads, timing.memoryBandwidth / 1e9);
+    }
+
+    double peakBandwidth = 0;
+    for (const ScalingTiming &timing: timings) {
+        peakBandwidth = std::max(peakBandwidth, timing.memoryBandwidth);
+    }
+    for (const ScalingTiming &timing: timings) {
+        if (timing.memoryBandwidth >= 0.9 * peakBandwidth) {
+            printf("\nMemory bandwidth saturates at %d thread(s) (%.1f GB/s, peak %.1f GB/s), "
+                   "where the pipeline runs %.2fx faster than on one thread.\n",
+                   timing.threads, timing.memoryBandwidth / 1e9, peakBandwidth / 1e9,
+                   baseTime / timing.executionTime);
+            break;
+        }
+    }
+}
+
+void printLoadReport(const std::vector<LoopLoad> &loops) {
+    if (loops.empty()) {
+        printf("No parallel loop ran on the pool.\n");
+        return;
+    }
+    size_t slotCount = loops.front().busyTimes.size();
+    std::vector<double> busyTimes(slotCount, 0), idleTimes(slotCount, 0);
+    std::vector<double> taskTimes;
+    double totalWallTime = 0, weightedImbalance = 0, totalBusyTime = 0, totalThreadTime = 0, tasksPerThread = 0;
+    for (const LoopLoad &loop: loops) {
+        taskTimes.insert(taskTimes.end(), loop.taskTimes.begin(), loop.taskTimes.end());
+        // The workers, and the other threads only if they ran tasks
+        int threads = 0;
+        double busiest = 0, busy = 0;
+        for (size_t slot = 0; slot < slotCount; slot++) {
+            if (slot + 1 == slotCount && loop.busyTimes[slot] == 0) {
+                continue;
+            }
+            threads++;
+            busyTimes[slot] += loop.busyTimes[slot];
+            idleTimes[slot] += std::max(0.0, loop.wallTime - loop.busyTimes[slot]);
+            busiest = std::max(busiest, loop.busyTimes[slot]);
+            busy += loop.busyTimes[slot];
+        }
+        totalWallTime += loop.wallTime;
+        totalBusyTime += busy;
+        totalThreadTime += threads * loop.wallTime;
+        tasksPerThread += (double) loop.taskTimes.size() / threads;
+        if (busy > 0) {
+            weightedImbalance += loop.wallTime * busiest / (busy / threads);
+        }
+    }
+    double imbalance = totalWallTime > 0 ? weightedImbalance / totalWallTime : 1;
+    tasksPerThread /= (double) loops.size();
+
+    double sum = 0, squares = 0;
+    for (double time: taskTimes) {
+        sum += time;
+        squares += time * time;
+    }
+    double mean = sum / (double) taskTimes.size();
+    double deviation = std::sqrt(std::max(0.0, squares / (double) taskTimes.size() - mean * mean));
+    printf("\nLoad balance over %zu parallel loop(s) of %zu task(s), %.1f tasks per thread per loop\n",
+           loops.size(), taskTimes.size(), tasksPerThread);
+    double median = percentile(taskTimes, 0.5);
+    double tail = percentile(taskTimes, 0.95);
+    printf("Task time [ms]: mean %.3f, p50 %.3f, p95 %.3f, max %.3f (coefficient of variation %.2f)\n",
+           mean * 1000, median * 1000, tail * 1000, taskTimes.back() * 1000, mean > 0 ? deviation / mean : 0);
+
+    printf("\n| **Thread** | **Busy [ms]** | **Idle [ms]** | **Busy** |\n");
+    printf("|------------|---------------|---------------|----------|\n");
+    for (size_t slot = 0; slot < slotCount; slot++) {
+        double time = busyTimes[slot] + idleTimes[slot];
+        if (time == 0) {
+            continue;
+        }
+        std::string name = slot + 1 < slotCount ? "worker " + std::to_string(slot) : "others";
+        printf("| %-10s | %13.2f | %13.2f | %7.0f%% |\n", name.c_str(), busyTimes[slot] * 1000,
+               idleTimes[slot] * 1000, 100 * busyTimes[slot] / time);
+    }
+
+    printf("\nImbalance (busiest / mean thread): %.2f, parallel efficiency %.0f%%\n", imbalance,
+           totalThreadTime > 0 ? 100 * totalBusyTime / totalThreadTime : 100);
+    if (imbalance <= 1.1) {
+        printf("The load is balanced.\n");
+    } else if (tasksPerThread < 4) {
+        printf("Too few tasks per thread to balance their differences: finer tiles would help.\n");
+    } else {
+        printf("The tasks are many but unevenly spread: smaller chunks (dynamic chunking) would help.\n");
+    }
+}
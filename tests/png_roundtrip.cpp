@@ -0,0 +1,104 @@
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <string>
+#include "Halide.h"
+#include "../lib/stb/stb_image.h"
+#include "imaging.h"
+#include "pngwriter.h"
+
+using namespace Halide;
+
+/**
+ * Encodes images with the strip encoder and decodes them with stb_image:
+ * 8- and 16-bit samples, 1 to 4 channels, one or several strips and all
+ * the filters. The strips' deflate streams, Adler-32 and CRC-32 values
+ * are stitched together by hand, which any mistake in would make the
+ * decoder reject the file or return other pixels.
+ */
+namespace {
+
+uint8_t *sampleAddress(const Buffer<> &image, int x, int y, int c) {
+    size_t offset = (size_t) x * image.dim(0).stride() + (size_t) y * image.dim(1).stride() +
+                    (image.dimensions() > 2 ? (size_t) c * image.dim(2).stride() : 0);
+    return (uint8_t *) image.data() + offset * image.type().bytes();
+}
+
+bool roundTrip(int bits, int channels, int width, int height, const PngOptions &options) {
+    Type type = bits == 8 ? UInt(8) : UInt(16);
+    Buffer<> image = channels > 1 ? Buffer<>::make_interleaved(type, width, height, channels)
+                                  : Buffer<>(type, width, height);
+    // Smooth gradients with noise, so that every filter has something to predict.
+    uint32_t state = 12345;
+    for (int y = 0; y < height; y++) {
+        for (int x = 0; x < width; x++) {
+            for (int c = 0; c < channels; c++) {
+                state = state * 1664525 + 1013904223;
+                uint32_t value = (x * 7 + y * 3 + c * 50) * (bits == 8 ? 1 : 257) + (state >> 28);
+                if (bits == 8) {
+                    *sampleAddress(image, x, y, c) = (uint8_t) value;
+                } else {
+                    auto sample = (uint16_t) value;
+                    memcpy(sampleAddress(image, x, y, c), &sample, sizeof(sample));
+                }
+            }
+        }
+    }
+
+    std::string path = (std::filesystem::temp_directory_path() / "png_roundtrip.png").string();
+    if (!writePngParallel(image, path, options)) {
+        printf("FAIL: writing a %d-bit image with %d channel(s) and %d strip(s)\n", bits, channels, options.threads);
+        return false;
+    }
+    int decodedWidth, decodedHeight, decodedChannels;
+    void *decoded = bits == 8 ? (void *) stbi_load(path.c_str(), &decodedWidth, &decodedHeight, &decodedChannels, 0)
+                              : (void *) stbi_load_16(path.c_str(), &decodedWidth, &decodedHeight,
+                                                      &decodedChannels, 0);
+    std::filesystem::remove(path);
+    if (!decoded || decodedWidth != width || decodedHeight != height || decodedChannels != channels) {
+        printf("FAIL: decoding a %d-bit image with %d channel(s), %d strip(s) and filter %d: %s\n",
+               bits, channels, options.threads, options.filter, decoded ? "wrong shape" : stbi_failure_reason());
+        stbi_image_free(decoded);
+        return false;
+    }
+    bool isEqual = true;
+    size_t sampleBytes = bits / 8;
+    for (int y = 0; y < height && isEqual; y++) {
+        for (int x = 0; x < width && isEqual; x++) {
+            for (int c = 0; c < channels && isEqual; c++) {
+                size_t index = ((size_t) y * width + x) * channels + c;
+                isEqual = memcmp((uint8_t *) decoded + index * sampleBytes, sampleAddress(image, x, y, c),
+                                 sampleBytes) == 0;
+            }
+        }
+    }
+    stbi_image_free(decoded);
+    if (!isEqual) {
+        printf("FAIL: pixels of a %d-bit image with %d channel(s), %d strip(s) and filter %d differ\n",
+               bits, channels, options.threads, options.filter);
+    }
+    return isEqual;
+}
+
+}
+
+int main() {
+    int failures = 0;
+    int runs = 0;
+    for (int bits: {8, 16}) {
+        for (int channels = 1; channels <= 4; channels++) {
+            for (int strips: {1, 3, 8}) {
+                for (int filter = -1; filter <= 4; filter++) {
+                    PngOptions options;
+                    options.threads = strips;
+                    options.filter = filter;
+                    options.compressionLevel = filter < 0 ? 9 : 1;
+                    failures += roundTrip(bits, channels, 37, 29, options) ? 0 : 1;
+                    runs++;
+                }
+            }
+        }
+    }
+    printf("%d of %d round trips passed\n", runs - failures, runs);
+    return failures == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}